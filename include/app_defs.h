@@ -77,6 +77,7 @@ typedef unsigned char  u8;
 #define	MIDISTART           0xFA
 #define	MIDICONTINUE        0xFB
 #define	MIDISTOP            0xFC
+#define	MIDIACTIVESENSE     0xFE
 
 // ____________________________________________________________________________
 //
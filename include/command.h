@@ -0,0 +1,142 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include "app_defs.h"
+
+// ____________________________________________________________________________
+//
+// Edit commands.  The surface handlers don't change the song directly - they
+// push a command onto a single producer, single consumer ring, and the timer
+// applies everything queued at the start of its next tick.  MIDI in has a ring
+// of its own for transport and transpose, so each ring has one producer.  An edit can never
+// land part way through triggering or drawing a step, and the engine is free
+// to cache anything it derives from the song.
+//
+// Commands describe the edit rather than its result (toggle, nudge, append),
+// so several queued in the same millisecond still add up correctly.  View
+// state - screen, current instrument, page and phrase being viewed - belongs
+// to the surface and is changed directly.
+// ____________________________________________________________________________
+
+#define COMMAND_QUEUE_SIZE		32 // must be a power of two, at most 128
+
+#define COMMAND_TOGGLE_STEP		0x01 // a: step (phrase * STEPS + step), b: voice
+#define COMMAND_APPEND_PHRASE	0x02 // a: phrase (1-32) to add to the end of the sequence
+#define COMMAND_REMOVE_PHRASE	0x03 // drop the last phrase of the sequence
+#define COMMAND_MUTE			0x04 // toggle the instrument's mute
+#define COMMAND_MUTE_VOICE		0x05 // a: voice
+#define COMMAND_SUSTAIN			0x06 // a: signed change in sustain, which stays above zero
+#define COMMAND_TEMPO			0x07 // a: signed change in tempo, instrument is ignored
+#define COMMAND_STORE_SCENE		0x08 // a: scene to copy the playing arrangement into, instrument is ignored
+#define COMMAND_PLAY			0x09 // instrument: port it came in on, or NOROUTE
+#define COMMAND_STOP			0x0A // a: 1 to return to zero if already stopped, instrument: as for play
+#define COMMAND_SEEK			0x0B // a, b: position in steps, low and high 7 bits, instrument: as for play
+#define COMMAND_UNDO			0x0C // instrument is ignored
+#define COMMAND_REDO			0x0D // instrument is ignored
+#define COMMAND_BASE_NOTE		0x0E // a: signed change in base note, which stays in the MIDI range
+#define COMMAND_SCALE			0x0F // a: signed number of scales to move on, wrapping round
+#define COMMAND_TRANSPOSE		0x10 // a: MIDI channel, b: note, instrument is ignored
+#define COMMAND_SET_STEP		0x11 // a: step (phrase * STEPS + step), b: voice, journaled as a toggle
+#define COMMAND_COPY_PHRASE		0x12 // a: phrase (0-31) to put on the clipboard
+#define COMMAND_PASTE_PHRASE	0x13 // a: phrase (0-31) to replace with the clipboard, b: filled in with the pool slot swapped in
+
+struct Command
+{
+	u8 op;
+	u8 instrument;
+	u8 a;
+	u8 b;
+};
+
+struct Commands
+{
+	struct Command ring[COMMAND_QUEUE_SIZE];
+	volatile u8 head; // written by the producer only
+	volatile u8 tail; // written by the consumer only
+};
+
+// ____________________________________________________________________________
+//
+// Undo journal.  Every edit command that changes something is recorded as it
+// was applied - the toggles undo themselves, an append is undone by a remove
+// and so on - so the journal never holds more than a command per edit, and
+// recording one is a single store.  Edits to arrangements apply to whichever
+// scene is playing when they're undone.  A paste swaps a pool slot into a
+// phrase, and its entry holds a reference to the slot it swapped out, so
+// undoing it is another swap - the reference goes when the entry does.
+// ____________________________________________________________________________
+
+#define JOURNAL_SIZE			32 // must be a power of two, at most 128
+
+struct Journal
+{
+	struct Command entries[JOURNAL_SIZE];
+	u8 head; // where the next edit goes
+	u8 undoable; // edits before head that can be undone
+	u8 redoable; // undone edits from head on that can be redone
+};
+
+struct Sequencer;
+
+/**
+ * Queue a command.  Call from the callback that owns the ring only - the
+ * surface pushes to commands, and MIDI in to midiCommands.
+ *
+ * @return 1 if it was queued, 0 if the ring was full and it was dropped.
+ */
+u8 CommandPush(struct Commands *commands, u8 op, u8 instrument, u8 a, u8 b);
+
+/**
+ * Apply every queued command, the surface's and then MIDI in's, each ring
+ * oldest first.  Called by the timer at the start
+ * of each tick - host tools that drive the engine without a timer can call it
+ * after each event instead.
+ */
+void CommandsApply(struct Sequencer *sequencer);
+
+/**
+ * Forget every edit in the journal, and let go of the pool slots its entries
+ * hold.  Call from the timer only, when something that isn't an edit -
+ * loading a song - replaces what the edits were made to.
+ */
+void JournalClear(struct Sequencer *sequencer);
+
+/**
+ * Apply a command straight away, and journal it if it's an edit, as though it
+ * had been queued.  Call from the timer only.
+ */
+void CommandApply(struct Sequencer *sequencer, u8 op, u8 instrument, u8 a, u8 b);
+
+#endif
@@ -0,0 +1,98 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+#ifndef PRESSURE_H
+#define PRESSURE_H
+
+#include "app_defs.h"
+
+// ____________________________________________________________________________
+//
+// Pad pressure.  The scanner reports every change in pressure with no onset
+// threshold, far more often than anything listening needs.  The aftertouch
+// callback just notes the latest value for each pad, and the timer sends the
+// ones that have moved far enough, no more often than once an interval per
+// pad, once the sequencer's own output has gone.
+// ____________________________________________________________________________
+
+#define PRESSURE_PADS			100 // pad indices the aftertouch callback can report
+#define PRESSURE_CHANNEL		PRESSURE_PADS // slot holding channel pressure
+#define PRESSURE_SLOTS			(PRESSURE_PADS + 1)
+#define PRESSURE_WORDS			((PRESSURE_SLOTS + 31) / 32)
+
+#define PRESSURE_INTERVAL		8 // default ms between messages for one pad
+#define PRESSURE_THRESHOLD		2 // default smallest change worth sending
+
+struct Pressure
+{
+	u8 latest[PRESSURE_SLOTS]; // last value from the scanner, or the loudest pad's for channel pressure
+	u8 sent[PRESSURE_SLOTS]; // last value sent
+	u16 time[PRESSURE_SLOTS]; // now when it was sent
+	u32 pending[PRESSURE_WORDS]; // bit flags for slots with a value waiting to go
+	u8 loudest; // pad channel pressure follows
+
+	u8 interval; // ms between messages for one pad, at most 127
+	u8 threshold; // smallest change worth sending - releases always go
+	u8 channelPressure; // nonzero to send the loudest pad as channel pressure instead
+
+	u16 suppressed; // values that were never sent, wraps
+};
+
+struct Sequencer;
+
+/**
+ * Set the default interval and threshold, and poly aftertouch.  The struct
+ * must already be zeroed, as it is inside a new struct Sequencer.
+ */
+void PressureInit(struct Pressure *pressure);
+
+/**
+ * Set the interval, threshold and mode from a SYSEX_PRESSURE_CONFIG message.
+ *
+ * @param data - the complete message, F0 to F7
+ * @param count - length of the message
+ * @return nonzero if the message was valid
+ */
+u8 PressureConfigure(struct Pressure *pressure, const u8 *data, u16 count);
+
+/**
+ * Note a pad's pressure.  Call from the aftertouch callback only.
+ */
+void PressureSample(struct Pressure *pressure, u8 index, u8 value);
+
+/**
+ * Send whatever's due to the USB MIDI port, on channel 1.  Called by the
+ * timer every tick.
+ */
+void PressureFlush(struct Sequencer *sequencer);
+
+#endif
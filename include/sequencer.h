@@ -0,0 +1,442 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include "app_defs.h"
+#include "command.h"
+#include "pressure.h"
+#include "sysex.h"
+#include "thru.h"
+#include "trace.h"
+
+// ____________________________________________________________________________
+//
+// The sequencer engine.  All of its state lives in a struct Sequencer, and the
+// app_* callbacks in app.c simply forward to the one instance the firmware
+// owns.  Host tools can create as many instances as they like - the engine
+// only talks to the outside world through the hal_* functions, so a host
+// running several instances at once should route those calls to whichever
+// instance it is currently driving.
+// ____________________________________________________________________________
+
+// timing defs
+#define MS_PER_MIN 60000
+#define CLOCK_RATE 24
+#define DEFAULTTEMPO 100
+#define MINTEMPO 10 // any slower and msPerTick doesn't fit in a u8
+#define MAXTEMPO 255
+
+// control buttons
+#define OVERVIEWSCREEN 0 // not a button - press the arranger screen button again
+#define ARRANGERSCREEN 1
+#define NOTESCREEN 2
+#define SCENESCREEN 3
+#define PLAYSONG 4
+#define STOPSONG 5 // acts on release - hold it and tap a slot in the arrangement to locate there instead
+#define NEXTSCALE 6 // steps the current instrument through the scales
+#define UNDO 7
+#define REDO 8
+#define TEMPODOWN 10
+#define TEMPOUP 20
+#define RELEASEDOWN 30
+#define RELEASEUP 40
+#define BANK 50 // steps through the banks of instruments the channel buttons select from
+#define REMOVEPHRASE 60
+#define APPENDPHRASE 70
+#define MUTECHANNEL 80
+#define PAGEUP 91
+#define PAGEDOWN 92
+#define PAGELEFT 93
+#define PAGERIGHT 94
+#define CHANNEL0 95
+#define CHANNEL1 96
+#define CHANNEL2 97
+#define CHANNEL3 98 // one button per instrument in the current bank
+#define MUTEVOICE0 19
+#define MUTEVOICE1 29
+#define MUTEVOICE2 39
+#define MUTEVOICE3 49
+#define MUTEVOICE4 59
+#define MUTEVOICE5 69
+#define MUTEVOICE6 79
+#define MUTEVOICE7 89
+
+// instrument properties
+#define LOWESTNOTE 36 // base note instruments start with
+#ifndef VOICEWORDS
+#define VOICEWORDS 1 // u32s of voice flags per step - each one adds 32 bytes per phrase in the pool
+#endif
+#define RANGE (VOICEWORDS * 32)
+#define VOICEWORD(voice) ((voice) >> 5) // index of the word holding a voice's flag
+#define VOICEBIT(voice) (1u << ((voice) & 31)) // and the flag within it
+
+// scales - how an instrument's voices map onto MIDI notes
+#define SCALE_CHROMATIC 0 // every note up from the base note
+#define SCALE_MAJOR 1
+#define SCALE_MINOR 2 // natural minor
+#define SCALE_PENTATONIC 3 // major pentatonic
+#define SCALE_DRUMS 4 // the General MIDI kit, commonest first - the base note is ignored
+#define SCALE_CUSTOM 5 // the instrument's customMap, which only a state dump can set
+#define NUMSCALES 6
+
+// live transpose - note-ons on an instrument's transpose channel move every
+// note it plays (unless it's a drum kit) from the start of the next bar.
+// Instruments opt in through their state message, and a channel nothing
+// listens to is passed on like any other
+#define TRANSPOSEROOT 60 // the note that puts them back where they were
+#define NOTRANSPOSE 0xFF // transposeChannel of an instrument that stays put, as they all do to begin with
+
+// step record - notes from a keyboard within CHORDWINDOW of the first are
+// written to the same step
+#define CHORDWINDOW 40 // ms
+#define MISSEDBELOW 1 // a note lower than any voice plays
+#define MISSEDABOVE 2 // and higher
+#define MISSEDSCALE 4 // a note between them that no voice plays, as it's out of the scale
+
+#define STEPS 8
+#define PHRASES 32
+#ifndef NUMINSTRUMENTS
+#define NUMINSTRUMENTS 8 // each costs about 0.75k of RAM with its share of the pool, and at most 32
+#endif
+#define INSTRUMENT0 0 // index into instruments[]
+#define BANKSIZE 4 // instruments per bank, one per channel button
+#define BANKS ((NUMINSTRUMENTS + BANKSIZE - 1) / BANKSIZE)
+
+#if NUMINSTRUMENTS > 32
+#error "NUMINSTRUMENTS must fit in the u32 active flags"
+#endif
+
+// scenes
+#define SCENES 8 // selected by the top row of the grid on the scene screen
+#define NOSCENE 0xFF
+#define BAR_STEPS 16 // scene changes wait for the start of a bar
+
+// routing
+#define ROUTES 2 // destinations each instrument can send its notes to
+#define NOROUTE 0xFF // port of a route that isn't used
+
+// Where an instrument's notes go
+struct Route{
+	u8 port; // USBSTANDALONE, USBMIDI, DINMIDI or NOROUTE
+	u8 channel; // MIDI channel (0, 15)
+};
+
+// A route with its status bytes worked out, ready for the timer to send
+struct Destination{
+	u8 port;
+	u8 noteOn;
+	u8 noteOff;
+};
+
+// What's in a phrase, kept up to date by PhraseWritten on every edit, so a
+// screen can show it without reading the steps.  A phrase is empty when it
+// has no notes.
+struct Summary{
+	u8 notes; // voice flags set across its steps, at most 255
+};
+
+// Phrases are stored once, in a pool shared by every instrument, and each of
+// an instrument's phrases refers to a slot in it.  Pasting a phrase only adds
+// a reference, and a shared slot is copied the first time it's edited.  Slot
+// EMPTYPHRASE is every phrase with no notes, so those take no room of their
+// own, and a phrase that's emptied gives its slot back.
+#ifndef POOLSIZE
+#define POOLSIZE (NUMINSTRUMENTS * PHRASES / 2 < 255 ? (NUMINSTRUMENTS * PHRASES / 2) + 1 : 256) // slots, counting EMPTYPHRASE
+#endif
+#define EMPTYPHRASE 0
+#define REFUSEDSTEPS 8 // how long the pad of an edit that didn't fit in the pool flashes
+
+struct Pool{
+	u32 steps[POOLSIZE][STEPS * VOICEWORDS]; // VOICEWORDS words of voice flags per step
+	struct Summary summaries[POOLSIZE];
+	u8 references[POOLSIZE]; // phrases, journal entries and the clipboard using each slot, 0 when it's free
+	u8 clipboard; // slot copied by COMMAND_COPY_PHRASE
+};
+
+struct Instrument{
+	u8 phrase; // Position through sequence of phrases - index into sequence
+	u8 phraseView; // Current screen we are editing (1, 32)
+	u8 phrases[PHRASES]; // pool slot holding each phrase
+	u8 pitchOffset;
+	u8 sustainStates[RANGE]; // Stores number of semiquavers left of each note duration
+	u8 baseNote; // MIDI note played by voice 0
+	u8 scale; // SCALE_CHROMATIC to SCALE_CUSTOM
+	u8 noteMap[RANGE]; // MIDI note each voice plays, built by MapNotes
+	u8 customMap[RANGE]; // noteMap for SCALE_CUSTOM, notes over 127 are silent
+	u8 soundingNotes[RANGE]; // MIDI note each sounding voice was started on
+	u8 transposeChannel; // MIDI channel (0, 15), or NOTRANSPOSE
+	s8 transpose; // semitones added by MapNotes
+	s8 nextTranspose; // transpose from the next bar
+	u8 sustain; // note sustain
+	u8 colour[3]; // LED colour
+	u8 channelButton; // Midi number corresponding to button to light up
+	u32 mutedVoices[VOICEWORDS]; // Bit flags for voices that are muted
+	u32 sounding[VOICEWORDS]; // Bit flags for voices with a non-zero sustainState
+	u32 playable[VOICEWORDS]; // Bit flags for voices with a note in noteMap
+	struct Route routes[ROUTES];
+	struct Destination destinations[ROUTES]; // built from routes by RouteInstrument
+	u8 destinationCount;
+};
+
+// A scene - the order each instrument plays its phrases in, which instruments
+// are muted, and the tempo.  The phrases themselves are shared by every scene.
+struct Arrangement{
+	u8 sequence[NUMINSTRUMENTS][PHRASES]; // Order of phrases (1, 32) to be played, 0 terminated
+	u8 length[NUMINSTRUMENTS]; // Entries in each sequence before the 0 - phrase n starts at step n * STEPS
+	u8 isMuted[NUMINSTRUMENTS]; // Channel mutes
+	u8 tempo;
+	u32 active; // Bit flags for instruments with a non-empty sequence - see SetSequenceLength
+};
+
+// Change the length of an instrument's sequence, keeping the active flags the
+// timer uses to skip empty instruments in step with it
+static inline void SetSequenceLength(struct Arrangement *arrangement, u8 instrument, u8 length)
+{
+	arrangement->length[instrument] = length;
+	if (length)
+	{
+		arrangement->active |= 1u << instrument;
+	}
+	else
+	{
+		arrangement->active &= ~(1u << instrument);
+	}
+}
+
+// SequencerMidi gathers a chord, and the timer writes it between steps once
+// the window closes - only the timer clears what the MIDI callback sets
+struct Record{
+	u32 chord[VOICEWORDS]; // voice flags played since the chord opened
+	volatile u16 opened; // now when it opened
+	volatile u8 open; // nonzero while a chord is gathering
+	volatile u8 missed; // MISSEDBELOW, MISSEDABOVE and MISSEDSCALE since the last chord was written
+	u8 on; // step recording, on the note screen only
+	u8 step; // cursor, phrase * STEPS + step, of the current instrument
+};
+
+// state loads - SequencerSysex queues the messages, and the timer loads them
+// after the edits at the start of a tick, so a load never lands part way
+// through a step or an edit
+#define LOADQUEUE 4 // messages, a power of two at most 128
+#define LOADPAYLOAD (STEPS * VOICEWORDS * 4 > PHRASES + 6 ? STEPS * VOICEWORDS * 4 : PHRASES + 6) // a phrase, or an old instrument with its sequence
+#define LOADSIZE (SYSEX_HEADER_SIZE + 2 + SYSEX_PACKED_SIZE(LOADPAYLOAD) + 1) // longest message, F0 to F7
+
+struct Load{
+	u8 data[LOADSIZE];
+	u16 length;
+	u8 port; // where a refusal goes
+};
+
+struct Loads{
+	struct Load ring[LOADQUEUE];
+	volatile u8 head; // written by the SysEx callback only
+	volatile u8 tail; // written by the timer only
+};
+
+// state dumps - SequencerSysex only asks for one, and the timer sends it a
+// message a tick rather than reading the song from the callback
+#define DUMPMESSAGES (1 + (NUMINSTRUMENTS * (PHRASES + 2)) + (SCENES * NUMINSTRUMENTS)) // global, instruments, note maps, phrases, arrangements
+
+struct Dump{
+	volatile u8 requested; // set by the SysEx callback, cleared by the timer
+	u8 port; // where the dump goes
+	u16 next; // message to send next, DUMPMESSAGES once it's all gone
+};
+
+struct Sequencer{
+	struct Instrument instruments[NUMINSTRUMENTS];
+	struct Pool pool; // every instrument's phrases
+
+	// the arrangement that's playing points into scenes[], and only changes
+	// at the start of a bar, so switching scenes never copies anything
+	struct Arrangement scenes[SCENES];
+	struct Arrangement *arrangement;
+	volatile u8 nextScene; // index into scenes[] to switch to, or NOSCENE
+	u32 ringing; // Bit flags for instruments with notes sounding, kept by TriggerNotes
+	u8 transposePending; // an instrument's nextTranspose differs from its transpose
+
+	u8 msPerTick;
+	u8 mode; // OVERVIEWSCREEN, ARRANGERSCREEN, NOTESCREEN or SCENESCREEN
+	u8 currentInstrument; // index into instruments[] - the bank shown is the one it's in
+
+	// timer state - everything the timer does happens on a clock pulse, so
+	// between pulses it only compares now against nextClock, and looks at the
+	// queues if a callback has woken it
+	u16 now; // ms since power on, wraps
+	u16 lastClock; // value of now at the last clock pulse
+	u16 nextClock; // value of now at the next clock pulse
+	u8 semiquaverInterval; // clock pulses since the last step
+	u8 step; // step within the current phrase
+	u8 barStep; // step within the current bar
+	u16 position; // steps since the start of the arrangement - a MIDI beat is one step
+	u8 playing; // 0 when stopped, the clock still runs
+	volatile u8 waiting; // set by the callbacks when they queue something, so ticks between pulses can skip the queues
+	u8 flash; // toggles every step to blink the playing phrase
+
+	// surface state
+	u8 muteChannelHeld;
+	u8 appendPhraseHeld;
+	u8 stopHeld; // 2 once it's been used to locate
+
+	struct Commands commands; // edits from the surface waiting for the next tick
+	struct Commands midiCommands; // transport and transpose from MIDI in
+	struct Loads loads; // state messages waiting for the next tick
+	struct Dump dump; // state dump on its way out
+	struct Journal journal; // edits that have been applied, for undo
+	struct Command refused; // the last edit turned away because the pool was full
+	u8 refusedFlash; // steps left to flash its pad
+	struct Thru thru; // incoming MIDI waiting to be passed on
+	struct Pressure pressure; // pad pressure waiting to be sent
+	struct Record record; // step record chord and cursor
+	struct Trace trace;
+};
+
+/**
+ * Bring a sequencer to its power-on state and send MIDI start.  The struct
+ * must be zeroed beforehand, which static storage gives you for free.
+ */
+void SequencerInit(struct Sequencer *sequencer);
+
+/**
+ * Advance the sequencer by one millisecond.  Runs from RAM on the device, along
+ * with the note and LED helpers it calls - see ramfunc.h.  Ticks between clock
+ * pulses return after two compares unless a callback has queued something
+ * since, and then only apply edits and loads, pass on thru traffic and pad
+ * pressure, write step-recorded chords and send the next dump message.
+ */
+void SequencerTimer(struct Sequencer *sequencer);
+
+/**
+ * Move every instrument to the given position in the playing arrangement,
+ * counted in steps from the start.  Arrangements shorter than the position
+ * wrap round, as they do when playing.
+ */
+void SequencerLocate(struct Sequencer *sequencer, u16 position);
+
+/**
+ * Transport.  Play sends MIDI start, or continue if the position isn't zero,
+ * and the first step plays on the next clock pulse.  Stop silences everything
+ * that's sounding and sends MIDI stop - stopping again returns to zero.  Seek
+ * locates and sends the new song position, and carries on playing if it was.
+ * The messages go out of every port but from, the port the request came in
+ * on, or NOROUTE if it came from the surface.  Call these from the timer
+ * only - everywhere else, push a command.
+ */
+void SequencerPlay(struct Sequencer *sequencer, u8 from);
+void SequencerStop(struct Sequencer *sequencer, u8 from);
+void SequencerSeek(struct Sequencer *sequencer, u16 position, u8 from);
+
+/**
+ * Send note offs for everything an instrument has sounding, at once.
+ */
+void SilenceInstrument(struct Sequencer *sequencer, struct Instrument *instrument);
+
+/**
+ * Rebuild an instrument's noteMap and playable voices after changing its
+ * scale, base note, transpose or customMap.  Voices that land outside the
+ * MIDI range are never played.  Notes already sounding stop at the pitch
+ * they started at.
+ */
+void MapNotes(struct Instrument *instrument);
+
+/**
+ * Get one of an instrument's phrases ready to change, copying it to a slot of
+ * its own first if anything else refers to it.  Call PhraseWritten after.
+ *
+ * @param phrase - index into PHRASES, from 0
+ * @return its steps, or 0 if the pool is full
+ */
+u32 *PhraseWrite(struct Sequencer *sequencer, struct Instrument *instrument, u8 phrase);
+
+/**
+ * Recount a phrase's notes after changing it, and give its slot back
+ * if it's now empty.
+ */
+void PhraseWritten(struct Sequencer *sequencer, struct Instrument *instrument, u8 phrase);
+
+/**
+ * Replace one of an instrument's phrases with a copy of some steps, sharing
+ * any slot that already holds the same ones.
+ *
+ * @return 0 if the pool is full, and the phrase is unchanged
+ */
+u8 PhraseStore(struct Sequencer *sequencer, struct Instrument *instrument, u8 phrase, const u32 *steps);
+
+/**
+ * Add a reference to a pool slot - EMPTYPHRASE isn't counted.
+ *
+ * @return 0 if the slot can't take any more
+ */
+u8 PhraseRetain(struct Pool *pool, u8 slot);
+
+/**
+ * Drop a reference to a pool slot, freeing it when nothing refers to it.
+ */
+void PhraseRelease(struct Pool *pool, u8 slot);
+
+/**
+ * Move every instrument to its nextTranspose.  The timer calls this at the
+ * start of each bar while playing.
+ */
+void LatchTranspose(struct Sequencer *sequencer);
+
+/**
+ * Rebuild an instrument's send list after changing its routes.  Routes to a
+ * port that doesn't exist are dropped, and so is a route that repeats one
+ * before it, so no note is ever sent twice to the same place.  Call from the
+ * timer only, once the instrument's been silenced, so no note off goes
+ * somewhere its note on didn't.
+ */
+void RouteInstrument(struct Instrument *instrument);
+
+/**
+ * Handlers for the matching app_* callbacks - see app.h for the parameters.
+ */
+void SequencerSurface(struct Sequencer *sequencer, u8 type, u8 index, u8 value);
+void SequencerMidi(struct Sequencer *sequencer, u8 port, u8 status, u8 d1, u8 d2);
+void SequencerSysex(struct Sequencer *sequencer, u8 port, u8 *data, u16 count);
+void SequencerAftertouch(struct Sequencer *sequencer, u8 index, u8 value);
+
+/**
+ * Send a MIDI message via the HAL, recording it in the trace.
+ */
+void SendMidi(struct Sequencer *sequencer, u8 port, u8 status, u8 d1, u8 d2);
+
+/**
+ * Set the tempo and recalculate the clock interval.  Tempos below MINTEMPO
+ * are raised to it.
+ */
+void CalculateMsPerClock(struct Sequencer *sequencer, u8 tempo);
+
+#endif
@@ -0,0 +1,98 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+#ifndef STATE_H
+#define STATE_H
+
+#include "sequencer.h"
+
+// ____________________________________________________________________________
+//
+// Sequencer state as SysEx.  A dump is one SYSEX_STATE_GLOBAL message, then a
+// SYSEX_STATE_INSTRUMENT message, a SYSEX_STATE_NOTEMAP message and PHRASES
+// SYSEX_STATE_PHRASE messages for each instrument, then a
+// SYSEX_STATE_ARRANGEMENT message for each instrument in each scene.  Sending the same messages back loads them, so a dump saved
+// on the host can be restored later, or produced by a host tool.
+// ____________________________________________________________________________
+
+/**
+ * Send the whole sequencer state as SysEx, all at once.  For host tools - on
+ * the device, the timer sends a dump a message at a time (see StateRequest).
+ * The dump holds no more different phrases than the pool, so it loads into a
+ * device with the same POOLSIZE - a tool that fills the pool has to warn
+ * about what it couldn't store itself, as midiimport does.
+ *
+ * @param port - where to send the dump
+ */
+void StateDump(struct Sequencer *sequencer, u8 port);
+
+/**
+ * Ask the timer for a dump.  Call from the SysEx callback only.
+ *
+ * @param port - where to send the dump
+ */
+void StateRequest(struct Sequencer *sequencer, u8 port);
+
+/**
+ * Send the next message of a requested dump, if there is one.  Called by the
+ * timer on ticks without a clock pulse, so the dump reads the song between
+ * edits rather than during them.
+ */
+void StateSend(struct Sequencer *sequencer);
+
+/**
+ * Queue a state message for the timer to load, or refuse it with
+ * SYSEX_REFUSED_BUSY if the queue is full.  Call from the SysEx callback only.
+ *
+ * @param port - where the message came from, and where a refusal goes
+ * @param data - the complete message, F0 to F7
+ * @param count - length of the message
+ */
+void StateQueue(struct Sequencer *sequencer, u8 port, const u8 *data, u16 count);
+
+/**
+ * Load every queued state message, refusing the ones that can't be loaded.
+ * Called by the timer at the start of each tick, after the edits - host tools
+ * that drive the engine without a timer can call it after each message.
+ */
+void StateFlush(struct Sequencer *sequencer);
+
+/**
+ * Load one state message.  Call from the timer only, or from a host tool.
+ *
+ * @param data - the complete message, F0 to F7
+ * @param count - length of the message
+ * @return 0 if it was loaded, or the SYSEX_REFUSED_ reason it wasn't
+ */
+u8 StateLoad(struct Sequencer *sequencer, const u8 *data, u16 count);
+
+#endif
@@ -0,0 +1,98 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+#ifndef SYSEX_H
+#define SYSEX_H
+
+#include "app_defs.h"
+
+// ____________________________________________________________________________
+//
+// SysEx protocol spoken by the sequencer.  All messages use the non-commercial
+// manufacturer ID, so they can't be mistaken for Novation's own messages:
+//
+// F0 7D <command> <payload...> F7
+//
+// Binary payloads are packed into 7-bit bytes with SysexPack - each group of
+// up to seven bytes is preceded by a byte holding their top bits.
+// ____________________________________________________________________________
+
+#define SYSEX_START			0xF0
+#define SYSEX_END			0xF7
+#define SYSEX_MANUFACTURER	0x7D
+
+// commands
+#define SYSEX_TRACE_REQUEST	0x01 // host -> device: F0 7D 01 F7
+#define SYSEX_TRACE_CHUNK	0x02 // device -> host: F0 7D 02 <chunk> <chunks> <events> <packed events> F7
+#define SYSEX_THRU_CONFIG	0x03 // host -> device: F0 7D 03 <port> <destination> <filter> <16 channels> F7
+#define SYSEX_PRESSURE_CONFIG 0x04 // host -> device: F0 7D 04 <interval> <threshold> <channel pressure> F7
+
+#define SYSEX_STATE_REQUEST	0x10 // host -> device: F0 7D 10 F7, device replies with the messages below
+#define SYSEX_STATE_GLOBAL	0x11 // F0 7D 11 <packed: playing scene, SCENES tempos> F7
+#define SYSEX_STATE_INSTRUMENT 0x12 // F0 7D 12 <instrument> <packed: sustain, mutedVoices, ROUTES ports and channels, baseNote, scale, transposeChannel> F7
+#define SYSEX_STATE_PHRASE	0x13 // F0 7D 13 <instrument> <phrase> <packed: STEPS x VOICEWORDS little endian u32s> F7
+#define SYSEX_STATE_ARRANGEMENT 0x14 // F0 7D 14 <scene> <instrument> <packed: sequence, isMuted> F7
+#define SYSEX_STATE_NOTEMAP	0x15 // F0 7D 15 <instrument> <packed: customMap> F7
+#define SYSEX_STATE_REFUSED	0x16 // device -> host: F0 7D 16 <reason> <command> <next two bytes of the message> F7
+
+// why a state message was refused
+#define SYSEX_REFUSED_BUSY	0x01 // too many messages waiting to be loaded - send it again
+#define SYSEX_REFUSED_INVALID 0x02 // not a state message this version understands
+#define SYSEX_REFUSED_FULL	0x03 // a phrase that didn't fit in the pool
+
+// offset of the first payload byte
+#define SYSEX_HEADER_SIZE	3
+
+// worst case size of n bytes once packed
+#define SYSEX_PACKED_SIZE(n) ((n) + (((n) + 6) / 7))
+
+/**
+ * Pack 8-bit data into 7-bit SysEx safe bytes.
+ *
+ * @param data - the bytes to pack
+ * @param length - how many bytes to pack
+ * @param out - receives the packed bytes, must hold SYSEX_PACKED_SIZE(length)
+ * @return the number of bytes written to out
+ */
+u16 SysexPack(const u8 *data, u16 length, u8 *out);
+
+/**
+ * Reverse SysexPack.
+ *
+ * @param data - packed bytes
+ * @param length - number of packed bytes
+ * @param out - receives the unpacked bytes
+ * @return the number of bytes written to out
+ */
+u16 SysexUnpack(const u8 *data, u16 length, u8 *out);
+
+#endif
@@ -0,0 +1,122 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+#ifndef THRU_H
+#define THRU_H
+
+#include "app_defs.h"
+
+// ____________________________________________________________________________
+//
+// MIDI thru and merge.  Messages that come in and aren't for the sequencer are
+// filtered and remapped according to the port they arrived on, then queued.
+// The timer passes a few of them on each tick, after the sequencer has sent
+// its own clock and notes, so a busy controller can't push those back.
+// ____________________________________________________________________________
+
+#define THRU_PORTS				(DINMIDI + 1) // USBSTANDALONE, USBMIDI and DINMIDI
+#define THRU_QUEUE_SIZE			32 // must be a power of two, at most 128
+#define THRU_BUDGET				4 // messages passed on per tick
+#define THRU_SYSEX_SIZE			128 // longest SysEx message that can be passed on
+
+// message types a port can filter out
+#define THRU_CLOCK				0x01 // timing clock and active sensing
+#define THRU_CC					0x02
+#define THRU_AFTERTOUCH			0x04 // poly and channel pressure
+#define THRU_SYSEX				0x08
+#define THRU_TRANSPORT			0x10 // start, stop, continue and song position aren't followed
+
+// what happens to messages arriving on a port
+struct ThruPort
+{
+	u8 destination; // port to pass them on to, or NOROUTE
+	u8 filter; // THRU_ flags for the message types to drop
+	u8 channels[16]; // channel each incoming channel is moved to
+};
+
+struct ThruMessage
+{
+	u8 port;
+	u8 status;
+	u8 d1;
+	u8 d2;
+};
+
+struct Thru
+{
+	struct ThruPort ports[THRU_PORTS]; // indexed by the port a message came in on
+
+	struct ThruMessage ring[THRU_QUEUE_SIZE];
+	volatile u8 head; // written by the MIDI callback only
+	volatile u8 tail; // written by the timer only
+
+	// one SysEx message at a time, sent on a tick of its own
+	u8 sysex[THRU_SYSEX_SIZE];
+	u16 sysexLength;
+	u8 sysexPort;
+	volatile u8 sysexPending;
+
+	u8 dropped; // messages lost because the queue was full, wraps
+};
+
+struct Sequencer;
+
+/**
+ * Set every port up to pass messages from the USB MIDI port to DIN and back,
+ * without SysEx, and without clock, which would clash with the sequencer's
+ * own.  Transport is followed from every port.
+ */
+void ThruInit(struct Thru *thru);
+
+/**
+ * Set up one port from a SYSEX_THRU_CONFIG message.
+ *
+ * @param data - the complete message, F0 to F7
+ * @param count - length of the message
+ * @return nonzero if the message was valid
+ */
+u8 ThruConfigure(struct Thru *thru, const u8 *data, u16 count);
+
+/**
+ * Filter, remap and queue a message.  Call from the MIDI callbacks only.
+ */
+void ThruMidi(struct Thru *thru, u8 port, u8 status, u8 d1, u8 d2);
+void ThruSysex(struct Thru *thru, u8 port, const u8 *data, u16 count);
+
+/**
+ * Pass queued messages on, up to THRU_BUDGET of them or one SysEx message.
+ * Called by the timer once the sequencer has sent everything it's going to
+ * this tick.
+ */
+void ThruFlush(struct Sequencer *sequencer);
+
+#endif
@@ -0,0 +1,132 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "app_defs.h"
+
+// ____________________________________________________________________________
+//
+// Event trace.  A fixed ring of compact, timestamped events that can be dumped
+// over SysEx after the fact (see TraceDump) and decoded on the host with
+// tools/tracedump.c.  Recording is a single atomic increment plus a six byte
+// store, so it's cheap enough to leave on in the hot paths.
+// ____________________________________________________________________________
+
+#define TRACE_SIZE			128 // must be a power of two
+#define TRACE_CHUNK			16 // events per SysEx chunk
+
+// event types live in the high nibble, the low nibble holds the port if any
+#define TRACE_SURFACE		0x10 // type, index, value
+#define TRACE_MIDI_IN		0x20 // status, d1, d2
+#define TRACE_MIDI_OUT		0x30 // status, d1, d2 (clock and pad pressure are not traced)
+#define TRACE_SYSEX_IN		0x40 // count low, count high, -
+#define TRACE_STEP			0x50 // step, tempo, -
+#define TRACE_PHRASE		0x60 // instrument, phrase, sequence entry
+#define TRACE_OVERRUN		0x70 // cycles spent in the timer callback, 24 bits MSB first
+#define TRACE_COUNTERS		0x80 // thru messages dropped, pad pressure readings suppressed (16 bits MSB first) - recorded as a dump is requested
+
+#define TRACE_TYPE(e)		((e) & 0xF0)
+#define TRACE_PORT(e)		((e) & 0x0F)
+
+// a 1ms timer callback taking longer than this has overrun its slot
+#define TRACE_OVERRUN_CYCLES 72000
+
+struct TraceEvent
+{
+	u16 time; // ms, wraps every 65 seconds
+	u8 event;
+	u8 data[3];
+};
+
+struct Trace
+{
+	struct TraceEvent events[TRACE_SIZE];
+	u16 head; // total events recorded - the newest is at head - 1, wraps
+	u8 full; // set once the ring has filled, so a wrapped head still dumps all of it
+	volatile u16 time; // ms counter used to stamp events
+};
+
+/**
+ * Record an event.  Safe to call from any callback - the slot is claimed
+ * with an atomic increment, so interrupting writers can't collide.
+ */
+static inline void TraceRecord(struct Trace *trace, u8 event, u8 d0, u8 d1, u8 d2)
+{
+	u16 n = __sync_fetch_and_add(&trace->head, 1);
+	struct TraceEvent *e = &trace->events[n & (TRACE_SIZE - 1)];
+
+	if (n == TRACE_SIZE - 1)
+	{
+		trace->full = 1;
+	}
+	e->time = trace->time;
+	e->event = event;
+	e->data[0] = d0;
+	e->data[1] = d1;
+	e->data[2] = d2;
+}
+
+/**
+ * Free running CPU cycle counter, used to catch timer overruns.  Reads as zero
+ * on the host, where there's nothing meaningful to measure.
+ */
+#ifdef __arm__
+#define DWT_CYCCNT			(*(volatile u32 *)0xE0001004)
+static inline u32 TraceCycles() { return DWT_CYCCNT; }
+#else
+static inline u32 TraceCycles() { return 0; }
+#endif
+
+/**
+ * Start the cycle counter.  Call once from app_init - the counter is shared
+ * by every trace.
+ */
+void TraceInit();
+
+/**
+ * Record an overrun if the timer callback that started at the given cycle
+ * count took longer than its slot.
+ */
+void TraceCheckOverrun(struct Trace *trace, u32 startCycles);
+
+/**
+ * Send the whole trace, oldest event first, as a series of
+ * SYSEX_TRACE_CHUNK messages.
+ *
+ * @param trace - the trace to send
+ * @param port - where to send the dump
+ */
+void TraceDump(struct Trace *trace, u8 port);
+
+#endif
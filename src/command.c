@@ -0,0 +1,482 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+//______________________________________________________________________________
+//
+// Headers
+//______________________________________________________________________________
+
+#include "app.h"
+#include "command.h"
+#include "ramfunc.h"
+#include "sequencer.h"
+
+//______________________________________________________________________________
+
+u8 CommandPush(struct Commands *commands, u8 op, u8 instrument, u8 a, u8 b)
+{
+	u8 head = commands->head;
+
+	if ((u8)(head - commands->tail) >= COMMAND_QUEUE_SIZE)
+	{
+		return 0;
+	}
+
+	struct Command *command = &commands->ring[head & (COMMAND_QUEUE_SIZE - 1)];
+	command->op = op;
+	command->instrument = instrument;
+	command->a = a;
+	command->b = b;
+
+	// the command must be complete before the consumer can see it
+	__sync_synchronize();
+	commands->head = head + 1;
+
+	return 1;
+}
+
+//______________________________________________________________________________
+
+#define REFUSED 2 // what Edit returns when it needed a pool slot and there wasn't one
+
+// an edit that needed a pool slot of its own when there were none left - the
+// note screen flashes its pad for a while, so it isn't silently ignored
+static RAMFUNC u8 Refuse(struct Sequencer *sequencer, const struct Command *command)
+{
+	sequencer->refused = *command;
+	sequencer->refusedFlash = REFUSEDSTEPS;
+
+	return REFUSED;
+}
+
+// Make an edit, filling in anything needed to undo it that the command didn't
+// say, and return 1 if it did, 0 if it made no difference or REFUSED.  These
+// are the commands the journal records.
+static RAMFUNC u8 Edit(struct Sequencer *sequencer, struct Command *command)
+{
+	struct Instrument *instrument = &sequencer->instruments[command->instrument];
+	u8 *sequence = sequencer->arrangement->sequence[command->instrument];
+	u8 *length = &sequencer->arrangement->length[command->instrument];
+
+	switch (command->op)
+	{
+		case COMMAND_TOGGLE_STEP:
+		{
+			if(command->b >= RANGE)
+			{
+				return 0;
+			}
+			u32 *steps = PhraseWrite(sequencer, instrument, command->a / STEPS);
+
+			if(!steps)
+			{
+				return Refuse(sequencer, command);
+			}
+			steps[((command->a % STEPS) * VOICEWORDS) + VOICEWORD(command->b)] ^= VOICEBIT(command->b);
+			PhraseWritten(sequencer, instrument, command->a / STEPS);
+		}
+		break;
+		case COMMAND_SET_STEP:
+		{
+			if(command->b >= RANGE)
+			{
+				return 0;
+			}
+			u8 word = ((command->a % STEPS) * VOICEWORDS) + VOICEWORD(command->b);
+
+			if(sequencer->pool.steps[instrument->phrases[command->a / STEPS]][word] & VOICEBIT(command->b))
+			{
+				return 0;
+			}
+
+			u32 *steps = PhraseWrite(sequencer, instrument, command->a / STEPS);
+
+			if(!steps)
+			{
+				return Refuse(sequencer, command);
+			}
+			steps[word] |= VOICEBIT(command->b);
+			PhraseWritten(sequencer, instrument, command->a / STEPS);
+
+			// and from now on it's undone and redone as a toggle
+			command->op = COMMAND_TOGGLE_STEP;
+		}
+		break;
+		case COMMAND_PASTE_PHRASE:
+		{
+			if(command->a >= PHRASES || instrument->phrases[command->a] == command->b)
+			{
+				return 0;
+			}
+
+			// the phrase's reference to the slot it had passes to the command
+			u8 swapped = instrument->phrases[command->a];
+
+			instrument->phrases[command->a] = command->b;
+			command->b = swapped;
+		}
+		break;
+		case COMMAND_APPEND_PHRASE:
+		{
+			if(*length >= PHRASES)
+			{
+				return 0;
+			}
+			sequence[*length] = command->a;
+			SetSequenceLength(sequencer->arrangement, command->instrument, *length + 1);
+		}
+		break;
+		case COMMAND_REMOVE_PHRASE:
+		{
+			if(*length == 0)
+			{
+				return 0;
+			}
+			command->a = sequence[*length - 1];
+			sequence[*length - 1] = 0;
+			SetSequenceLength(sequencer->arrangement, command->instrument, *length - 1);
+		}
+		break;
+		case COMMAND_MUTE:
+		{
+			sequencer->arrangement->isMuted[command->instrument] ^= 1;
+		}
+		break;
+		case COMMAND_MUTE_VOICE:
+		{
+			if(command->a >= RANGE)
+			{
+				return 0;
+			}
+			u32 *flags = &instrument->mutedVoices[VOICEWORD(command->a)];
+
+			*flags = *flags ^ VOICEBIT(command->a);
+		}
+		break;
+		case COMMAND_SUSTAIN:
+		{
+			s8 change = command->a;
+
+			if(change < 0 && instrument->sustain <= -change)
+			{
+				return 0;
+			}
+			instrument->sustain += change;
+		}
+		break;
+		case COMMAND_TEMPO:
+		{
+			s16 tempo = sequencer->arrangement->tempo + (s8)command->a;
+
+			tempo = tempo < MINTEMPO ? MINTEMPO : tempo > MAXTEMPO ? MAXTEMPO : tempo;
+			if(tempo == sequencer->arrangement->tempo)
+			{
+				return 0;
+			}
+
+			// journal the change that was made, so undo puts it back exactly
+			command->a = tempo - sequencer->arrangement->tempo;
+			CalculateMsPerClock(sequencer, tempo);
+		}
+		break;
+		case COMMAND_BASE_NOTE:
+		{
+			s16 baseNote = instrument->baseNote + (s8)command->a;
+
+			if(baseNote < 0 || baseNote > 127)
+			{
+				return 0;
+			}
+
+			instrument->baseNote = baseNote;
+			MapNotes(instrument);
+		}
+		break;
+		case COMMAND_SCALE:
+		{
+			u8 scale = (instrument->scale + NUMSCALES + ((s8)command->a % NUMSCALES)) % NUMSCALES;
+
+			if(scale == instrument->scale)
+			{
+				return 0;
+			}
+
+			instrument->scale = scale;
+			MapNotes(instrument);
+		}
+		break;
+		default:
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+// undo an edit made by Edit, returning what Edit would
+static RAMFUNC u8 Revert(struct Sequencer *sequencer, struct Command *entry)
+{
+	struct Command command = *entry;
+
+	switch (command.op)
+	{
+		case COMMAND_PASTE_PHRASE:
+		{
+			// swapping back leaves the entry with the pasted slot, to redo it
+			return Edit(sequencer, entry);
+		}
+		case COMMAND_APPEND_PHRASE:
+		{
+			command.op = COMMAND_REMOVE_PHRASE;
+		}
+		break;
+		case COMMAND_REMOVE_PHRASE:
+		{
+			command.op = COMMAND_APPEND_PHRASE;
+		}
+		break;
+		case COMMAND_SUSTAIN:
+		{
+			sequencer->instruments[command.instrument].sustain -= (s8)command.a;
+		}
+		return 1;
+		case COMMAND_TEMPO:
+		case COMMAND_BASE_NOTE:
+		case COMMAND_SCALE:
+		{
+			command.a = -(s8)command.a;
+		}
+		break;
+	}
+
+	// toggles undo themselves
+	return Edit(sequencer, &command);
+}
+
+// let go of anything a journal entry holds, as it's dropped
+static RAMFUNC void Forget(struct Sequencer *sequencer, const struct Command *entry)
+{
+	if(entry->op == COMMAND_PASTE_PHRASE)
+	{
+		PhraseRelease(&sequencer->pool, entry->b);
+	}
+}
+
+// make an edit and journal it, which forgets anything that was undone, and
+// return 0 if it made no difference
+static RAMFUNC u8 Remember(struct Sequencer *sequencer, struct Command command)
+{
+	struct Journal *journal = &sequencer->journal;
+
+	if(Edit(sequencer, &command) != 1)
+	{
+		return 0;
+	}
+
+	for(u8 i = 0; i < journal->redoable; i++)
+	{
+		Forget(sequencer, &journal->entries[(journal->head + i) & (JOURNAL_SIZE - 1)]);
+	}
+
+	// a full journal loses its oldest edit
+	if(journal->undoable == JOURNAL_SIZE)
+	{
+		Forget(sequencer, &journal->entries[journal->head & (JOURNAL_SIZE - 1)]);
+	}
+
+	journal->entries[journal->head++ & (JOURNAL_SIZE - 1)] = command;
+	if(journal->undoable < JOURNAL_SIZE)
+	{
+		journal->undoable++;
+	}
+	journal->redoable = 0;
+
+	return 1;
+}
+
+void JournalClear(struct Sequencer *sequencer)
+{
+	struct Journal *journal = &sequencer->journal;
+	u8 first = journal->head - journal->undoable;
+
+	for(u8 i = 0; i < journal->undoable + journal->redoable; i++)
+	{
+		Forget(sequencer, &journal->entries[(first + i) & (JOURNAL_SIZE - 1)]);
+	}
+	journal->undoable = 0;
+	journal->redoable = 0;
+}
+
+static RAMFUNC void Apply(struct Sequencer *sequencer, struct Command command)
+{
+	struct Journal *journal = &sequencer->journal;
+
+	switch (command.op)
+	{
+		case COMMAND_UNDO:
+		{
+			// an edit the pool can't make room for stays where it is, to try again
+			if(journal->undoable && Revert(sequencer, &journal->entries[(journal->head - 1) & (JOURNAL_SIZE - 1)]) != REFUSED)
+			{
+				journal->head--;
+				journal->undoable--;
+				journal->redoable++;
+			}
+		}
+		break;
+		case COMMAND_REDO:
+		{
+			if(journal->redoable && Edit(sequencer, &journal->entries[journal->head & (JOURNAL_SIZE - 1)]) != REFUSED)
+			{
+				journal->head++;
+				journal->redoable--;
+				journal->undoable++;
+			}
+		}
+		break;
+		case COMMAND_STORE_SCENE:
+		{
+			const u8 *from = (const u8 *)sequencer->arrangement;
+			u8 *to = (u8 *)&sequencer->scenes[command.a];
+
+			// not a struct assignment, which could turn into a call to memcpy
+			for(u16 i = 0; i < sizeof(struct Arrangement); i++)
+			{
+				to[i] = from[i];
+			}
+		}
+		break;
+		case COMMAND_PLAY:
+		{
+			SequencerPlay(sequencer, command.instrument);
+		}
+		break;
+		case COMMAND_STOP:
+		{
+			if(command.a && !sequencer->playing)
+			{
+				SequencerSeek(sequencer, 0, command.instrument);
+			}
+			else
+			{
+				SequencerStop(sequencer, command.instrument);
+			}
+		}
+		break;
+		case COMMAND_SEEK:
+		{
+			SequencerSeek(sequencer, command.a | (command.b << 7), command.instrument);
+		}
+		break;
+		case COMMAND_TRANSPOSE:
+		{
+			for(u8 i = 0; i < NUMINSTRUMENTS; i++)
+			{
+				if(sequencer->instruments[i].transposeChannel == command.a)
+				{
+					sequencer->instruments[i].nextTranspose = command.b - TRANSPOSEROOT;
+					sequencer->transposePending = 1;
+				}
+			}
+
+			// there's no bar to wait for
+			if(!sequencer->playing)
+			{
+				LatchTranspose(sequencer);
+			}
+		}
+		break;
+		case COMMAND_COPY_PHRASE:
+		{
+			struct Pool *pool = &sequencer->pool;
+			u8 slot = sequencer->instruments[command.instrument].phrases[command.a & (PHRASES - 1)];
+
+			if(command.a < PHRASES && PhraseRetain(pool, slot))
+			{
+				PhraseRelease(pool, pool->clipboard);
+				pool->clipboard = slot;
+			}
+		}
+		break;
+		case COMMAND_PASTE_PHRASE:
+		{
+			// the paste takes a reference to the clipboard's slot, for the phrase
+			command.b = sequencer->pool.clipboard;
+			if(PhraseRetain(&sequencer->pool, command.b) && !Remember(sequencer, command))
+			{
+				PhraseRelease(&sequencer->pool, command.b);
+			}
+		}
+		break;
+		default:
+		{
+			Remember(sequencer, command);
+		}
+		break;
+	}
+}
+
+static RAMFUNC void Drain(struct Sequencer *sequencer, struct Commands *commands)
+{
+	u8 tail = commands->tail;
+
+	while (tail != commands->head)
+	{
+		// don't read the command until we've seen it published
+		__sync_synchronize();
+		struct Command command = commands->ring[tail & (COMMAND_QUEUE_SIZE - 1)];
+
+		// and don't hand the slot back until we've read it
+		__sync_synchronize();
+		commands->tail = ++tail;
+
+		Apply(sequencer, command);
+	}
+}
+
+RAMFUNC void CommandsApply(struct Sequencer *sequencer)
+{
+	Drain(sequencer, &sequencer->commands);
+	Drain(sequencer, &sequencer->midiCommands);
+}
+
+RAMFUNC void CommandApply(struct Sequencer *sequencer, u8 op, u8 instrument, u8 a, u8 b)
+{
+	struct Command command;
+
+	command.op = op;
+	command.instrument = instrument;
+	command.a = a;
+	command.b = b;
+	Apply(sequencer, command);
+}
@@ -0,0 +1,170 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+//______________________________________________________________________________
+//
+// Headers
+//______________________________________________________________________________
+
+#include "app.h"
+#include "pressure.h"
+#include "ramfunc.h"
+#include "sequencer.h"
+#include "sysex.h"
+
+//______________________________________________________________________________
+
+void PressureInit(struct Pressure *pressure)
+{
+	pressure->interval = PRESSURE_INTERVAL;
+	pressure->threshold = PRESSURE_THRESHOLD;
+	pressure->channelPressure = 0;
+}
+
+u8 PressureConfigure(struct Pressure *pressure, const u8 *data, u16 count)
+{
+	if (count != SYSEX_HEADER_SIZE + 3 + 1)
+	{
+		return 0;
+	}
+
+	pressure->interval = data[SYSEX_HEADER_SIZE];
+	pressure->threshold = data[SYSEX_HEADER_SIZE + 1];
+	pressure->channelPressure = data[SYSEX_HEADER_SIZE + 2];
+
+	return 1;
+}
+
+//______________________________________________________________________________
+
+// queue a slot's latest value if it's far enough from what was last sent
+static void Update(struct Pressure *pressure, u8 slot)
+{
+	u8 value = pressure->latest[slot];
+	u8 sent = pressure->sent[slot];
+	u8 change = value > sent ? value - sent : sent - value;
+	u32 bit = 1u << (slot & 31);
+	u32 *pending = &pressure->pending[slot >> 5];
+
+	if (change == 0 || (change < pressure->threshold && value != 0))
+	{
+		// anything still waiting isn't worth sending now either
+		u32 waiting = __sync_fetch_and_and(pending, ~bit) & bit;
+
+		if (waiting || change != 0)
+		{
+			pressure->suppressed++;
+		}
+		return;
+	}
+
+	// a value nobody heard is replaced by this one
+	if (__sync_fetch_and_or(pending, bit) & bit)
+	{
+		pressure->suppressed++;
+	}
+}
+
+void PressureSample(struct Pressure *pressure, u8 index, u8 value)
+{
+	if (index >= PRESSURE_PADS)
+	{
+		return;
+	}
+
+	pressure->latest[index] = value;
+
+	if (!pressure->channelPressure)
+	{
+		Update(pressure, index);
+		return;
+	}
+
+	// channel pressure follows the hardest pressed pad
+	if (value >= pressure->latest[pressure->loudest])
+	{
+		pressure->loudest = index;
+	}
+	else if (index == pressure->loudest)
+	{
+		for (u8 pad = 0; pad < PRESSURE_PADS; pad++)
+		{
+			if (pressure->latest[pad] > pressure->latest[pressure->loudest])
+			{
+				pressure->loudest = pad;
+			}
+		}
+	}
+
+	pressure->latest[PRESSURE_CHANNEL] = pressure->latest[pressure->loudest];
+	Update(pressure, PRESSURE_CHANNEL);
+}
+
+//______________________________________________________________________________
+
+RAMFUNC void PressureFlush(struct Sequencer *sequencer)
+{
+	struct Pressure *pressure = &sequencer->pressure;
+	u16 now = sequencer->now;
+
+	for (u8 word = 0; word < PRESSURE_WORDS; word++)
+	{
+		u32 bits = pressure->pending[word];
+
+		while (bits)
+		{
+			u8 bit = __builtin_ctz(bits);
+			u8 slot = (word << 5) + bit;
+
+			bits &= bits - 1;
+
+			if ((u16)(now - pressure->time[slot]) < pressure->interval)
+			{
+				continue;
+			}
+
+			__sync_fetch_and_and(&pressure->pending[word], ~(1u << bit));
+			u8 value = pressure->latest[slot];
+
+			if (slot == PRESSURE_CHANNEL)
+			{
+				hal_send_midi(USBMIDI, CHANNELAFTERTOUCH | 0, value, 0);
+			}
+			else
+			{
+				hal_send_midi(USBMIDI, POLYAFTERTOUCH | 0, slot, value);
+			}
+			pressure->sent[slot] = value;
+			pressure->time[slot] = now;
+		}
+	}
+}
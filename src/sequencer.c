@@ -0,0 +1,1820 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+//______________________________________________________________________________
+//
+// Headers
+//______________________________________________________________________________
+
+#include "app.h"
+#include "command.h"
+#include "ramfunc.h"
+#include "sequencer.h"
+#include "state.h"
+#include "sysex.h"
+#include "trace.h"
+
+//______________________________________________________________________________
+
+// NUMINSTRUMENTS and VOICEWORDS trade against each other for RAM, and the HAL,
+// the stack and RAMFUNC code need what the sequencer leaves of the 20k - catch
+// a combination that can't fit here, rather than in the linker's .bss total
+#ifdef __arm__
+#define SEQUENCER_RAM_BUDGET (14 * 1024)
+typedef char SequencerFitsInRam[sizeof(struct Sequencer) <= SEQUENCER_RAM_BUDGET ? 1 : -1];
+#endif
+
+// each bank uses the same colours, in channel button order
+static const u8 COLOURS[BANKSIZE][3] =
+{
+	{21, 42, 63},
+	{63, 21, 42},
+	{21, 63, 42},
+	{42, 21, 63},
+};
+
+// each scale's notes within an octave of the base note
+struct Scale{
+	u8 length;
+	u8 intervals[12];
+};
+
+static const struct Scale SCALE_INTERVALS[] =
+{
+	[SCALE_CHROMATIC] = {12, {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}},
+	[SCALE_MAJOR] = {7, {0, 2, 4, 5, 7, 9, 11}},
+	[SCALE_MINOR] = {7, {0, 2, 3, 5, 7, 8, 10}},
+	[SCALE_PENTATONIC] = {5, {0, 2, 4, 7, 9}},
+};
+
+// a row of the grid for each of the first eight, then the rest of the kit
+static const u8 DRUM_MAP[32] =
+{
+	36, 38, 42, 46, 39, 45, 48, 49, // kick, snare, hats, clap, toms, crash
+	37, 40, 44, 41, 43, 47, 50, 51, // rim, snare 2, pedal hat, more toms, ride
+	35, 52, 53, 54, 55, 56, 57, 59, // kick 2, cymbals, tambourine, cowbell
+	60, 61, 62, 63, 64, 69, 70, 75, // bongos, congas, cabasa, maracas, claves
+};
+
+// the NEXTSCALE button shows the current instrument's scale
+static const u8 SCALE_COLOURS[NUMSCALES][3] =
+{
+	[SCALE_CHROMATIC] = {20, 20, 20},
+	[SCALE_MAJOR] = {MAXLED, 40, 0},
+	[SCALE_MINOR] = {0, 20, MAXLED},
+	[SCALE_PENTATONIC] = {0, MAXLED, 20},
+	[SCALE_DRUMS] = {MAXLED, 0, 20},
+	[SCALE_CUSTOM] = {MAXLED, 0, MAXLED},
+};
+
+void MakeInstruments(struct Sequencer *sequencer)
+{
+	u8 i;
+	for(i = 0; i < NUMINSTRUMENTS; i++ )
+	{
+		sequencer->instruments[i].phrase = 0;
+		sequencer->instruments[i].phraseView = 1;
+		sequencer->instruments[i].sustain = 4;
+		sequencer->instruments[i].baseNote = LOWESTNOTE;
+		sequencer->instruments[i].transposeChannel = NOTRANSPOSE;
+		for(u8 voice = 0; voice < RANGE; voice++)
+		{
+			sequencer->instruments[i].customMap[voice] = LOWESTNOTE + voice;
+		}
+		MapNotes(&sequencer->instruments[i]);
+		sequencer->instruments[i].routes[0].port = DINMIDI;
+		sequencer->instruments[i].routes[0].channel = i;
+		sequencer->instruments[i].routes[1].port = USBSTANDALONE;
+		sequencer->instruments[i].routes[1].channel = i;
+		RouteInstrument(&sequencer->instruments[i]);
+		sequencer->instruments[i].colour[0] = COLOURS[i % BANKSIZE][0];
+		sequencer->instruments[i].colour[1] = COLOURS[i % BANKSIZE][1];
+		sequencer->instruments[i].colour[2] = COLOURS[i % BANKSIZE][2];
+		sequencer->instruments[i].channelButton = CHANNEL0 + (i % BANKSIZE);
+	}
+}
+
+void MapNotes(struct Instrument *instrument)
+{
+	for (u8 word = 0; word < VOICEWORDS; word++)
+	{
+		instrument->playable[word] = 0;
+	}
+
+	for (u8 voice = 0; voice < RANGE; voice++)
+	{
+		s16 note;
+
+		switch (instrument->scale)
+		{
+			case SCALE_DRUMS:
+			{
+				note = voice < sizeof(DRUM_MAP) ? DRUM_MAP[voice] : 128;
+			}
+			break;
+			case SCALE_CUSTOM:
+			{
+				note = instrument->customMap[voice] + instrument->transpose;
+			}
+			break;
+			default:
+			{
+				const struct Scale *scale = &SCALE_INTERVALS[instrument->scale];
+
+				note = instrument->baseNote + instrument->transpose + (12 * (voice / scale->length)) + scale->intervals[voice % scale->length];
+			}
+			break;
+		}
+
+		if (note >= 0 && note < 128)
+		{
+			instrument->noteMap[voice] = note;
+			instrument->playable[VOICEWORD(voice)] |= VOICEBIT(voice);
+		}
+		else
+		{
+			instrument->noteMap[voice] = 0;
+		}
+	}
+}
+
+void LatchTranspose(struct Sequencer *sequencer)
+{
+	for (u8 i = 0; i < NUMINSTRUMENTS; i++)
+	{
+		struct Instrument *instrument = &sequencer->instruments[i];
+
+		if (instrument->transpose != instrument->nextTranspose)
+		{
+			instrument->transpose = instrument->nextTranspose;
+			MapNotes(instrument);
+		}
+	}
+	sequencer->transposePending = 0;
+}
+
+// count the flags in a word of voices - there's no popcount instruction on
+// the M3, and no libgcc to provide one
+static u8 CountVoices(u32 voices)
+{
+	voices = voices - ((voices >> 1) & 0x55555555);
+	voices = (voices & 0x33333333) + ((voices >> 2) & 0x33333333);
+	voices = (voices + (voices >> 4)) & 0x0F0F0F0F;
+
+	return (voices * 0x01010101) >> 24;
+}
+
+static void Summarise(struct Pool *pool, u8 slot)
+{
+	const u32 *flags = pool->steps[slot];
+	u16 notes = 0;
+
+	for (u8 i = 0; i < STEPS * VOICEWORDS; i++)
+	{
+		notes += CountVoices(flags[i]);
+	}
+
+	pool->summaries[slot].notes = notes > 255 ? 255 : notes;
+}
+
+// a free slot, or EMPTYPHRASE if there isn't one
+static u8 Allocate(struct Pool *pool)
+{
+	for (u16 slot = EMPTYPHRASE + 1; slot < POOLSIZE; slot++)
+	{
+		if (pool->references[slot] == 0)
+		{
+			pool->references[slot] = 1;
+			return slot;
+		}
+	}
+	return EMPTYPHRASE;
+}
+
+u8 PhraseRetain(struct Pool *pool, u8 slot)
+{
+	if (slot == EMPTYPHRASE)
+	{
+		return 1;
+	}
+	if (pool->references[slot] == 0xFF)
+	{
+		return 0;
+	}
+	pool->references[slot]++;
+	return 1;
+}
+
+void PhraseRelease(struct Pool *pool, u8 slot)
+{
+	if (slot != EMPTYPHRASE)
+	{
+		pool->references[slot]--;
+	}
+}
+
+u32 *PhraseWrite(struct Sequencer *sequencer, struct Instrument *instrument, u8 phrase)
+{
+	struct Pool *pool = &sequencer->pool;
+	u8 slot = instrument->phrases[phrase];
+
+	if (slot == EMPTYPHRASE || pool->references[slot] > 1)
+	{
+		u8 copy = Allocate(pool);
+
+		if (copy == EMPTYPHRASE)
+		{
+			return 0;
+		}
+
+		// a word at a time, as anything bigger could turn into a call to memcpy
+		for (u8 i = 0; i < STEPS * VOICEWORDS; i++)
+		{
+			pool->steps[copy][i] = pool->steps[slot][i];
+		}
+		pool->summaries[copy] = pool->summaries[slot];
+		PhraseRelease(pool, slot);
+		instrument->phrases[phrase] = copy;
+		slot = copy;
+	}
+
+	return pool->steps[slot];
+}
+
+void PhraseWritten(struct Sequencer *sequencer, struct Instrument *instrument, u8 phrase)
+{
+	struct Pool *pool = &sequencer->pool;
+	u8 slot = instrument->phrases[phrase];
+
+	Summarise(pool, slot);
+	if (pool->summaries[slot].notes == 0)
+	{
+		PhraseRelease(pool, slot);
+		instrument->phrases[phrase] = EMPTYPHRASE;
+	}
+}
+
+u8 PhraseStore(struct Sequencer *sequencer, struct Instrument *instrument, u8 phrase, const u32 *steps)
+{
+	struct Pool *pool = &sequencer->pool;
+	u16 slot;
+	u8 i;
+
+	// look for the same steps - the empty phrase is always there to find
+	for (slot = EMPTYPHRASE; slot < POOLSIZE; slot++)
+	{
+		if (slot != EMPTYPHRASE && pool->references[slot] == 0)
+		{
+			continue;
+		}
+		for (i = 0; i < STEPS * VOICEWORDS && pool->steps[slot][i] == steps[i]; i++)
+		{
+		}
+		if (i == STEPS * VOICEWORDS)
+		{
+			break;
+		}
+	}
+
+	if (slot < POOLSIZE)
+	{
+		if (!PhraseRetain(pool, slot))
+		{
+			return 0;
+		}
+	}
+	else
+	{
+		slot = Allocate(pool);
+		if (slot == EMPTYPHRASE)
+		{
+			return 0;
+		}
+		for (i = 0; i < STEPS * VOICEWORDS; i++)
+		{
+			pool->steps[slot][i] = steps[i];
+		}
+		Summarise(pool, slot);
+	}
+
+	PhraseRelease(pool, instrument->phrases[phrase]);
+	instrument->phrases[phrase] = slot;
+	return 1;
+}
+
+void RouteInstrument(struct Instrument *instrument)
+{
+	u8 count = 0;
+
+	for (u8 i = 0; i < ROUTES; i++)
+	{
+		u8 port = instrument->routes[i].port;
+		u8 noteOn = NOTEON | (instrument->routes[i].channel & 0x0F);
+		u8 j;
+
+		if (port > DINMIDI)
+		{
+			continue;
+		}
+		for (j = 0; j < count; j++)
+		{
+			if (instrument->destinations[j].port == port && instrument->destinations[j].noteOn == noteOn)
+			{
+				break;
+			}
+		}
+		if (j < count)
+		{
+			continue;
+		}
+
+		instrument->destinations[count].port = port;
+		instrument->destinations[count].noteOn = noteOn;
+		instrument->destinations[count].noteOff = NOTEOFF | (noteOn & 0x0F);
+		count++;
+	}
+
+	instrument->destinationCount = count;
+}
+
+RAMFUNC void SendMidi(struct Sequencer *sequencer, u8 port, u8 status, u8 d1, u8 d2)
+{
+	TraceRecord(&sequencer->trace, TRACE_MIDI_OUT | port, status, d1, d2);
+	hal_send_midi(port, status, d1, d2);
+}
+
+RAMFUNC int IsNoteOn(const u32 *flags, u8 voice)
+{
+    return ((flags[VOICEWORD(voice)] & VOICEBIT(voice)) != 0);
+}
+
+RAMFUNC void IncrementSequence(struct Instrument *instrument, u8 length)
+{
+	instrument->phrase++;
+	if(instrument->phrase >= length)
+	{
+		instrument->phrase = 0;
+	}
+}
+
+RAMFUNC void TriggerNotes(struct Sequencer *sequencer, struct Instrument *instrument, u8 step, u8 channel)
+{
+	const u8 *sequence = sequencer->arrangement->sequence[channel];
+	u8 slot = EMPTYPHRASE;
+	u32 ringing = 0;
+
+	// with nothing to play, notes already sounding still run out and stop
+	if(sequence[instrument->phrase] != 0)
+	{
+		slot = instrument->phrases[sequence[instrument->phrase] - 1];
+	}
+
+	const u32 *flags = &sequencer->pool.steps[slot][step * VOICEWORDS];
+	u8 isMuted = sequencer->arrangement->isMuted[channel];
+
+	for (u8 word = 0; word < VOICEWORDS; word++)
+	{
+		u32 triggered = isMuted ? 0 : flags[word] & ~instrument->mutedVoices[word] & instrument->playable[word];
+		u32 notes = instrument->sounding[word] | triggered;
+		u32 sounding = 0;
+
+		// only voices that are sounding or starting need looking at
+		while (notes)
+		{
+			u8 bit = __builtin_ctz(notes);
+			u8 note = (word << 5) + bit;
+
+			notes &= notes - 1;
+
+			// Send note off Messages
+			if(instrument->sustainStates[note] == 1)
+			{
+				for (u8 d = 0; d < instrument->destinationCount; d++)
+				{
+					SendMidi(sequencer, instrument->destinations[d].port, instrument->destinations[d].noteOff, instrument->soundingNotes[note], 0);
+				}
+			}
+			if(instrument->sustainStates[note] > 0)
+			{
+				instrument->sustainStates[note] -= 1;
+			}
+
+			if (triggered & (1u << bit))
+			{
+				u8 pitch = instrument->noteMap[note];
+
+				// a voice retriggered since it was transposed moves to its new pitch
+				if(instrument->sustainStates[note] > 0 && instrument->soundingNotes[note] != pitch)
+				{
+					for (u8 d = 0; d < instrument->destinationCount; d++)
+					{
+						SendMidi(sequencer, instrument->destinations[d].port, instrument->destinations[d].noteOff, instrument->soundingNotes[note], 0);
+					}
+				}
+				for (u8 d = 0; d < instrument->destinationCount; d++)
+				{
+					SendMidi(sequencer, instrument->destinations[d].port, instrument->destinations[d].noteOn, pitch, 127);
+				}
+				instrument->soundingNotes[note] = pitch;
+
+				instrument->sustainStates[note] = instrument->sustain;
+			}
+
+			if(instrument->sustainStates[note] > 0)
+			{
+				sounding |= 1u << bit;
+			}
+		}
+
+		instrument->sounding[word] = sounding;
+		ringing |= sounding;
+	}
+
+	// keep it running until they stop, even if its sequence empties first
+	if(ringing)
+	{
+		sequencer->ringing |= 1u << channel;
+	}
+	else
+	{
+		sequencer->ringing &= ~(1u << channel);
+	}
+};
+
+void CalculateMsPerClock(struct Sequencer *sequencer, u8 tempo)
+{
+	if (tempo < MINTEMPO)
+	{
+		tempo = MINTEMPO;
+	}
+
+	sequencer->arrangement->tempo = tempo;
+    sequencer->msPerTick = MS_PER_MIN / (CLOCK_RATE * tempo);
+
+	// a new tempo applies to the pulse in progress, as if the ms since the
+	// last one had been counted against it all along
+	sequencer->nextClock = sequencer->lastClock + sequencer->msPerTick;
+}
+
+RAMFUNC void PlotClear()
+{
+	for (int i = 0; i <= 90; i += 10)
+	{
+		for (int j = 0; j < 10; j++)
+		{
+			hal_plot_led(TYPEPAD, i+j, 0, 0, 0);
+		}
+	}
+}
+
+RAMFUNC void PlotNotes(struct Pool *pool, struct Instrument *instrument)
+{
+	const u32 *steps = pool->steps[instrument->phrases[instrument->phraseView - 1]];
+	u8 bottom = instrument->pitchOffset;
+	u8 top = bottom + STEPS;
+	for (u8 step = 0; step < STEPS; step ++)
+	{
+		for (u8 bit = bottom; bit < top; bit++)
+		{
+			if(IsNoteOn(&steps[step * VOICEWORDS], bit))
+			{
+				hal_plot_led(TYPEPAD, (10 * (bit - instrument->pitchOffset)) + step + 11, instrument->colour[0], instrument->colour[1], instrument->colour[2]);
+			}
+		}
+	}
+}
+
+// an edit that didn't fit in the pool flashes red where it was tapped
+RAMFUNC void PlotRefused(struct Sequencer *sequencer, struct Instrument *instrument)
+{
+	const struct Command *refused = &sequencer->refused;
+	u8 row = refused->b - instrument->pitchOffset;
+
+	if(!(sequencer->refusedFlash & 1) || &sequencer->instruments[refused->instrument] != instrument || (refused->a / STEPS) + 1 != instrument->phraseView || row >= 8)
+	{
+		return;
+	}
+
+	hal_plot_led(TYPEPAD, (10 * row) + (refused->a % STEPS) + 11, MAXLED, 0, 0);
+}
+
+// rows playing the root note of the scale are lit dimly underneath the notes
+RAMFUNC void PlotRoots(struct Instrument *instrument)
+{
+	if(instrument->scale >= SCALE_DRUMS)
+	{
+		return;
+	}
+
+	for (u8 row = 0; row < 8; row++)
+	{
+		u8 voice = row + instrument->pitchOffset;
+
+		if(IsNoteOn(instrument->playable, voice) && (instrument->noteMap[voice] % 12) == (instrument->baseNote % 12))
+		{
+			for (u8 step = 0; step < STEPS; step++)
+			{
+				hal_plot_led(TYPEPAD, (10 * row) + step + 11, instrument->colour[0] / 8, instrument->colour[1] / 8, instrument->colour[2] / 8);
+			}
+		}
+	}
+}
+
+RAMFUNC void PlotPlayhead(u8 step)
+{
+	// if (step == 0)
+	// {
+	// 	for (u8 i = 1; i < 9; i++)
+	// 	{
+	// 		hal_plot_led(TYPEPAD, 8 + (i * 10), 0, 0, 0);
+	// 	}
+	// }
+	// else
+	// {
+	// 	for (u8 i = 1; i < 9; i++)
+	// 	{
+	// 		hal_plot_led(TYPEPAD, step + (i * 10), 0, 0, 0);
+	// 	}
+	// }
+
+	for (u8 i = 1; i < 9; i++)
+	{
+		hal_plot_led(TYPEPAD, (step + 1) + (i * 10), MAXLED, MAXLED, MAXLED);
+	}
+}
+
+// the step record cursor is a dim red column, with its top or bottom pad lit
+// brighter for a note no voice plays
+RAMFUNC void PlotCursor(struct Record *record, struct Instrument *instrument)
+{
+	hal_plot_led(TYPEPAD, NOTESCREEN, MAXLED, 0, 0);
+
+	if((record->step / STEPS) + 1 != instrument->phraseView)
+	{
+		return;
+	}
+
+	u8 column = (record->step % STEPS) + 1;
+
+	for (u8 i = 1; i < 9; i++)
+	{
+		hal_plot_led(TYPEPAD, column + (i * 10), MAXLED / 4, 0, 0);
+	}
+	if(record->missed & MISSEDBELOW)
+	{
+		hal_plot_led(TYPEPAD, column + 10, MAXLED, 0, 0);
+	}
+	if(record->missed & MISSEDABOVE)
+	{
+		hal_plot_led(TYPEPAD, column + 80, MAXLED, 0, 0);
+	}
+	if(record->missed & MISSEDSCALE)
+	{
+		hal_plot_led(TYPEPAD, column + 40, MAXLED, 0, 0);
+		hal_plot_led(TYPEPAD, column + 50, MAXLED, 0, 0);
+	}
+}
+
+RAMFUNC void PlotButtons(struct Instrument *instrument, u8 isMuted, u8 isCurrent)
+{
+	if(isCurrent)
+	{
+		if(isMuted)
+		{
+			hal_plot_led(TYPEPAD, instrument->channelButton, MAXLED, 0, 0);
+		}
+		else
+		{
+			hal_plot_led(TYPEPAD, instrument->channelButton, instrument->colour[0], instrument->colour[1], instrument->colour[2]);
+		}
+
+		hal_plot_led(TYPEPAD, ARRANGERSCREEN, instrument->colour[0], instrument->colour[1], instrument->colour[2]);
+		hal_plot_led(TYPEPAD, NEXTSCALE, SCALE_COLOURS[instrument->scale][0], SCALE_COLOURS[instrument->scale][1], SCALE_COLOURS[instrument->scale][2]);
+	}
+	else
+	{
+		if(isMuted)
+		{
+			hal_plot_led(TYPEPAD, instrument->channelButton, MAXLED, 0, 0);
+		}
+		else
+		{
+			hal_plot_led(TYPEPAD, instrument->channelButton, instrument->colour[0] / 4, instrument->colour[1] / 4, instrument->colour[2] / 4);
+		}
+	}
+
+	for(u8 i = 0; i < 8; i++)
+	{
+		if(IsNoteOn(instrument->mutedVoices, i + instrument->pitchOffset))
+		{
+			hal_plot_led(TYPEPAD, (10 * (i + 1)) + 9, MAXLED, 0, 0);
+		}
+	}
+
+	// Plot individual staticly coloured buttons.
+	hal_plot_led(TYPEPAD, PAGEUP, MAXLED, MAXLED, MAXLED);
+	hal_plot_led(TYPEPAD, PAGEDOWN, MAXLED, MAXLED, MAXLED);
+	hal_plot_led(TYPEPAD, PAGELEFT, MAXLED, MAXLED, MAXLED);
+	hal_plot_led(TYPEPAD, PAGERIGHT, MAXLED, MAXLED, MAXLED);
+
+	hal_plot_led(TYPEPAD, MUTECHANNEL, 20, 0, 0);
+	hal_plot_led(TYPEPAD, APPENDPHRASE, 0, 0, MAXLED);
+	hal_plot_led(TYPEPAD, REMOVEPHRASE, 10, 0, MAXLED);
+
+	hal_plot_led(TYPEPAD, RELEASEUP, 0, MAXLED, 10);
+	hal_plot_led(TYPEPAD, RELEASEDOWN, 0, 10, 5);
+
+	hal_plot_led(TYPEPAD, TEMPOUP, 0, MAXLED, 0);
+	hal_plot_led(TYPEPAD, TEMPODOWN, 0, 10, 0);
+
+	hal_plot_led(TYPEPAD, NOTESCREEN, MAXLED, MAXLED, MAXLED);
+	hal_plot_led(TYPEPAD, SCENESCREEN, MAXLED, MAXLED, MAXLED);
+}
+
+
+// how brightly to light a phrase, in quarters of full - off when it's empty
+static RAMFUNC u8 Density(const struct Summary *summary)
+{
+	return summary->notes >= 12 ? 4 : (summary->notes + 3) / 4;
+}
+
+// empty phrases are lit dimly, so it's easy to see where the material is
+RAMFUNC void PlotPhrases(struct Instrument *instrument)
+{
+    for(u8 i = 0; i < PHRASES; i++)
+    {
+        if(i == instrument->phraseView - 1)
+        {
+            hal_plot_led(TYPEPAD, PHRASES_MAP[i], MAXLED, MAXLED, MAXLED);
+			continue;
+        }
+
+		if(instrument->phrases[i] == EMPTYPHRASE)
+		{
+			hal_plot_led(TYPEPAD, PHRASES_MAP[i], instrument->colour[0] / 8, instrument->colour[1] / 8, instrument->colour[2] / 8);
+			continue;
+		}
+
+        hal_plot_led(TYPEPAD, PHRASES_MAP[i], instrument->colour[0], instrument->colour[1], instrument->colour[2]);
+    }
+}
+
+// the overview has a row per instrument, from the top, across the eight
+// phrases around the one being viewed, lit by how many notes each has - the
+// phrase each instrument is playing is white
+RAMFUNC void PlotOverview(struct Sequencer *sequencer)
+{
+	u8 first = sequencer->currentInstrument - (sequencer->currentInstrument % 8);
+	u8 page = (sequencer->instruments[sequencer->currentInstrument].phraseView - 1) / 8;
+
+	for(u8 row = 0; row < 8 && first + row < NUMINSTRUMENTS; row++)
+	{
+		struct Instrument *instrument = &sequencer->instruments[first + row];
+		u8 playing = 0;
+
+		if(sequencer->playing && sequencer->arrangement->length[first + row])
+		{
+			playing = sequencer->arrangement->sequence[first + row][instrument->phrase];
+		}
+
+		for(u8 column = 0; column < 8; column++)
+		{
+			u8 phrase = (page * 8) + column;
+			u8 index = ((8 - row) * 10) + column + 1;
+			u8 density = Density(&sequencer->pool.summaries[instrument->phrases[phrase]]);
+
+			if(phrase + 1 == playing)
+			{
+				hal_plot_led(TYPEPAD, index, MAXLED, MAXLED, MAXLED);
+			}
+			else if(density)
+			{
+				hal_plot_led(TYPEPAD, index, (instrument->colour[0] * density) / 4, (instrument->colour[1] * density) / 4, (instrument->colour[2] * density) / 4);
+			}
+		}
+	}
+}
+
+RAMFUNC void PlotSequence(struct Sequencer *sequencer, struct Instrument *instrument, const u8 *sequence, u8 length)
+{
+    sequencer->flash = sequencer->flash ^ 1;
+
+	for(u8 i = 0; i < length; i++)
+	{
+		if(sequence[i] == instrument->phraseView)
+		{
+			if(i == instrument->phrase)
+			{
+				hal_plot_led(TYPEPAD, ARRANGER_MAP[i], MAXLED * sequencer->flash, MAXLED * sequencer->flash, MAXLED * sequencer->flash);
+			}
+			else
+			{
+				hal_plot_led(TYPEPAD, ARRANGER_MAP[i], MAXLED, MAXLED, MAXLED);
+			}
+		}
+		else
+		{
+			if(i == instrument->phrase)
+			{
+				hal_plot_led(TYPEPAD, ARRANGER_MAP[i], instrument->colour[0] * sequencer->flash, instrument->colour[1] * sequencer->flash, instrument->colour[2] * sequencer->flash);
+			}
+			else
+			{
+				hal_plot_led(TYPEPAD, ARRANGER_MAP[i], instrument->colour[0], instrument->colour[1], instrument->colour[2]);
+			}
+		}
+	}
+}
+
+// the playing scene is white and a queued one flashes, stored scenes are blue
+RAMFUNC void PlotScenes(struct Sequencer *sequencer)
+{
+    sequencer->flash = sequencer->flash ^ 1;
+
+	for(u8 scene = 0; scene < SCENES; scene++)
+	{
+		struct Arrangement *arrangement = &sequencer->scenes[scene];
+		u8 index = 81 + scene;
+
+		if(scene == sequencer->nextScene)
+		{
+			hal_plot_led(TYPEPAD, index, MAXLED * sequencer->flash, MAXLED * sequencer->flash, MAXLED * sequencer->flash);
+		}
+		else if(arrangement == sequencer->arrangement)
+		{
+			hal_plot_led(TYPEPAD, index, MAXLED, MAXLED, MAXLED);
+		}
+		else
+		{
+			for(u8 i = 0; i < NUMINSTRUMENTS; i++)
+			{
+				if(arrangement->length[i] != 0)
+				{
+					hal_plot_led(TYPEPAD, index, 0, 10, MAXLED);
+					break;
+				}
+			}
+		}
+	}
+}
+
+// switch to the queued scene from the start of its arrangement
+RAMFUNC void SwitchScene(struct Sequencer *sequencer)
+{
+	sequencer->arrangement = &sequencer->scenes[sequencer->nextScene];
+	sequencer->nextScene = NOSCENE;
+
+	CalculateMsPerClock(sequencer, sequencer->arrangement->tempo);
+
+	for(u8 i = 0; i < NUMINSTRUMENTS; i++)
+	{
+		sequencer->instruments[i].phrase = 0;
+		TraceRecord(&sequencer->trace, TRACE_PHRASE, i, 0, sequencer->arrangement->sequence[i][0]);
+	}
+	sequencer->step = 0;
+	sequencer->position = 0;
+}
+
+// the play button is bright while playing, the stop button while stopped
+RAMFUNC void PlotTransport(struct Sequencer *sequencer)
+{
+	if(sequencer->playing)
+	{
+		hal_plot_led(TYPEPAD, PLAYSONG, 0, MAXLED, 0);
+		hal_plot_led(TYPEPAD, STOPSONG, 10, 0, 0);
+	}
+	else
+	{
+		hal_plot_led(TYPEPAD, PLAYSONG, 0, 10, 0);
+		hal_plot_led(TYPEPAD, STOPSONG, MAXLED, 0, 0);
+	}
+}
+
+// the bank button gets brighter for each bank along
+RAMFUNC void PlotBank(u8 bank)
+{
+	if(BANKS > 1)
+	{
+		u8 level = (MAXLED * (bank + 1)) / BANKS;
+
+		hal_plot_led(TYPEPAD, BANK, level, level, level);
+	}
+}
+
+// undo and redo light up when there's something to undo or redo
+RAMFUNC void PlotJournal(struct Journal *journal)
+{
+	if(journal->undoable)
+	{
+		hal_plot_led(TYPEPAD, UNDO, MAXLED, 20, 0);
+	}
+	if(journal->redoable)
+	{
+		hal_plot_led(TYPEPAD, REDO, MAXLED, 20, 0);
+	}
+}
+
+//______________________________________________________________________________
+//
+// Pad handlers, dispatched by index through the tables below.  Each one is
+// passed the index of the pad that was pressed (or released).
+//______________________________________________________________________________
+
+#define PAD_INDICES 100 // 10x10, corners included
+
+typedef void (*PadHandler)(struct Sequencer *sequencer, u8 index);
+
+static struct Instrument *Current(struct Sequencer *sequencer)
+{
+	return &sequencer->instruments[sequencer->currentInstrument];
+}
+
+// the screen buttons double as the mode they select
+static void PadScreen(struct Sequencer *sequencer, u8 index)
+{
+	sequencer->mode = index;
+	sequencer->record.on = 0;
+}
+
+// pressed again, the arranger screen button switches to the overview and back
+static void PadArrangerScreen(struct Sequencer *sequencer, u8 index)
+{
+	sequencer->mode = sequencer->mode == ARRANGERSCREEN ? OVERVIEWSCREEN : ARRANGERSCREEN;
+	sequencer->record.on = 0;
+}
+
+// pressed again, the note screen button starts or stops step record from the
+// first step in view
+static void PadNoteScreen(struct Sequencer *sequencer, u8 index)
+{
+	if(sequencer->mode == NOTESCREEN)
+	{
+		sequencer->record.step = (Current(sequencer)->phraseView - 1) * STEPS;
+		sequencer->record.missed = 0;
+		sequencer->record.on ^= 1;
+	}
+	sequencer->mode = NOTESCREEN;
+}
+
+static void PadMuteChannel(struct Sequencer *sequencer, u8 index)
+{
+	sequencer->muteChannelHeld = 1;
+}
+
+static void PadAppendPhrase(struct Sequencer *sequencer, u8 index)
+{
+	sequencer->appendPhraseHeld = 1;
+}
+
+static void PadUndo(struct Sequencer *sequencer, u8 index)
+{
+	CommandPush(&sequencer->commands, COMMAND_UNDO, 0, 0, 0);
+}
+
+static void PadRedo(struct Sequencer *sequencer, u8 index)
+{
+	CommandPush(&sequencer->commands, COMMAND_REDO, 0, 0, 0);
+}
+
+static void PadPlay(struct Sequencer *sequencer, u8 index)
+{
+	CommandPush(&sequencer->commands, COMMAND_PLAY, NOROUTE, 0, 0);
+}
+
+// STOPSONG acts when it's released, unless it was held to locate
+static void PadStop(struct Sequencer *sequencer, u8 index)
+{
+	sequencer->stopHeld = 1;
+}
+
+static void PadRemovePhrase(struct Sequencer *sequencer, u8 index)
+{
+	CommandPush(&sequencer->commands, COMMAND_REMOVE_PHRASE, sequencer->currentInstrument, 0, 0);
+}
+
+// CHANNEL0 to CHANNEL3 select (or with MUTECHANNEL held, mute) an instrument in the current bank
+static void PadChannel(struct Sequencer *sequencer, u8 index)
+{
+	u8 instrument = (sequencer->currentInstrument - (sequencer->currentInstrument % BANKSIZE)) + (index - CHANNEL0);
+
+	if(instrument >= NUMINSTRUMENTS)
+	{
+		return;
+	}
+
+	if(sequencer->muteChannelHeld)
+	{
+		CommandPush(&sequencer->commands, COMMAND_MUTE, instrument, 0, 0);
+	}
+	else
+	{
+		sequencer->currentInstrument = instrument;
+	}
+}
+
+// move to the same channel button in the next bank, or the first if there isn't one
+static void PadBank(struct Sequencer *sequencer, u8 index)
+{
+	u8 instrument = sequencer->currentInstrument + BANKSIZE;
+
+	if(instrument >= NUMINSTRUMENTS)
+	{
+		instrument = sequencer->currentInstrument % BANKSIZE;
+	}
+	sequencer->currentInstrument = instrument;
+}
+
+static void PadNextScale(struct Sequencer *sequencer, u8 index)
+{
+	CommandPush(&sequencer->commands, COMMAND_SCALE, sequencer->currentInstrument, 1, 0);
+}
+
+static void PadReleaseUp(struct Sequencer *sequencer, u8 index)
+{
+	CommandPush(&sequencer->commands, COMMAND_SUSTAIN, sequencer->currentInstrument, 1, 0);
+}
+
+static void PadReleaseDown(struct Sequencer *sequencer, u8 index)
+{
+	CommandPush(&sequencer->commands, COMMAND_SUSTAIN, sequencer->currentInstrument, (u8)-1, 0);
+}
+
+static void PadTempoDown(struct Sequencer *sequencer, u8 index)
+{
+	CommandPush(&sequencer->commands, COMMAND_TEMPO, 0, (u8)-5, 0);
+}
+
+static void PadTempoUp(struct Sequencer *sequencer, u8 index)
+{
+	CommandPush(&sequencer->commands, COMMAND_TEMPO, 0, 5, 0);
+}
+
+static void PadPageLeft(struct Sequencer *sequencer, u8 index)
+{
+	struct Instrument *current = Current(sequencer);
+
+	// the overview pages by its width
+	if(sequencer->mode == OVERVIEWSCREEN)
+	{
+		current->phraseView = current->phraseView > 8 ? current->phraseView - 8 : 1;
+	}
+	else if(current->phraseView != 1)
+	{
+		current->phraseView -= 1;
+		sequencer->record.step = (current->phraseView - 1) * STEPS;
+	}
+}
+
+static void PadPageRight(struct Sequencer *sequencer, u8 index)
+{
+	struct Instrument *current = Current(sequencer);
+
+	if(sequencer->mode == OVERVIEWSCREEN)
+	{
+		current->phraseView = current->phraseView <= PHRASES - 8 ? current->phraseView + 8 : PHRASES;
+	}
+	else if(current->phraseView != 32)
+	{
+		current->phraseView += 1;
+		sequencer->record.step = (current->phraseView - 1) * STEPS;
+	}
+}
+
+// page up and down through the voices, or with MUTECHANNEL held, move the
+// whole instrument up or down an octave
+static void PadPageUp(struct Sequencer *sequencer, u8 index)
+{
+	struct Instrument *current = Current(sequencer);
+
+	if(sequencer->muteChannelHeld)
+	{
+		CommandPush(&sequencer->commands, COMMAND_BASE_NOTE, sequencer->currentInstrument, 12, 0);
+	}
+	else if(current->pitchOffset < RANGE - STEPS)
+	{
+		current->pitchOffset += 1;
+	}
+}
+
+static void PadPageDown(struct Sequencer *sequencer, u8 index)
+{
+	struct Instrument *current = Current(sequencer);
+
+	if(sequencer->muteChannelHeld)
+	{
+		CommandPush(&sequencer->commands, COMMAND_BASE_NOTE, sequencer->currentInstrument, (u8)-12, 0);
+	}
+	else if(current->pitchOffset != 0)
+	{
+		current->pitchOffset -= 1;
+	}
+}
+
+// MUTEVOICE0 to MUTEVOICE7 run up the right hand column, one per visible row
+static void PadMuteVoice(struct Sequencer *sequencer, u8 index)
+{
+	CommandPush(&sequencer->commands, COMMAND_MUTE_VOICE, sequencer->currentInstrument, Current(sequencer)->pitchOffset + (index / 10) - 1, 0);
+}
+
+static void PadArranger(struct Sequencer *sequencer, u8 index)
+{
+	struct Instrument *current = Current(sequencer);
+	const u8 *sequence = sequencer->arrangement->sequence[sequencer->currentInstrument];
+	u8 slot = PAD_TO_INDEX_MAP[index];
+
+	if(sequencer->appendPhraseHeld)
+	{
+		if(index < 49) // Check that the pad we hit is in the bottom half of the pads
+		{
+			CommandPush(&sequencer->commands, COMMAND_APPEND_PHRASE, sequencer->currentInstrument, slot, 0);
+		}
+	}
+	else
+	{
+		if(index > 49)
+		{
+			// the top half shows the arrangement - view the phrase in that slot,
+			// or with STOPSONG held, locate to it
+			if(slot != 0 && slot <= sequencer->arrangement->length[sequencer->currentInstrument])
+			{
+				if(sequencer->stopHeld)
+				{
+					u16 position = (slot - 1) * STEPS;
+
+					sequencer->stopHeld = 2;
+					CommandPush(&sequencer->commands, COMMAND_SEEK, NOROUTE, position & 0x7F, position >> 7);
+				}
+				else
+				{
+					current->phraseView = sequence[slot - 1];
+				}
+			}
+		}
+		else
+		{
+			current->phraseView = slot;
+		}
+	}
+}
+
+// the grid shows eight steps of the phrase being viewed, across eight voices
+// from pitchOffset up - while step recording, it moves the cursor instead
+static void PadNote(struct Sequencer *sequencer, u8 index)
+{
+	struct Instrument *current = Current(sequencer);
+	u8 step = (index % 10) + ((current->phraseView - 1) * STEPS) - 1;
+	u8 voice = ((index / 10) - 1) + current->pitchOffset;
+
+	if(sequencer->record.on)
+	{
+		sequencer->record.step = step;
+		return;
+	}
+
+	CommandPush(&sequencer->commands, COMMAND_TOGGLE_STEP, sequencer->currentInstrument, step, voice);
+}
+
+// tap a phrase in the overview to edit it on the note screen, or with
+// MUTECHANNEL held copy it, or with APPENDPHRASE held paste over it
+static void PadOverview(struct Sequencer *sequencer, u8 index)
+{
+	u8 instrument = (sequencer->currentInstrument - (sequencer->currentInstrument % 8)) + 8 - (index / 10);
+
+	if(instrument >= NUMINSTRUMENTS)
+	{
+		return;
+	}
+
+	u8 phrase = (((Current(sequencer)->phraseView - 1) / 8) * 8) + (index % 10) - 1;
+
+	if(sequencer->muteChannelHeld)
+	{
+		CommandPush(&sequencer->commands, COMMAND_COPY_PHRASE, instrument, phrase, 0);
+	}
+	else if(sequencer->appendPhraseHeld)
+	{
+		CommandPush(&sequencer->commands, COMMAND_PASTE_PHRASE, instrument, phrase, 0);
+	}
+	else
+	{
+		sequencer->currentInstrument = instrument;
+		Current(sequencer)->phraseView = phrase + 1;
+		sequencer->mode = NOTESCREEN;
+	}
+}
+
+// the top row picks the scene to play from the next bar, or with APPENDPHRASE
+// held, stores the playing arrangement in it
+static void PadScene(struct Sequencer *sequencer, u8 index)
+{
+	u8 scene = index - 81;
+
+	if(sequencer->appendPhraseHeld)
+	{
+		CommandPush(&sequencer->commands, COMMAND_STORE_SCENE, 0, scene, 0);
+	}
+	else if(&sequencer->scenes[scene] == sequencer->arrangement)
+	{
+		sequencer->nextScene = NOSCENE;
+	}
+	else
+	{
+		sequencer->nextScene = scene;
+	}
+}
+
+static void PadMuteChannelUp(struct Sequencer *sequencer, u8 index)
+{
+	// releasing MUTECHANNEL has always released APPENDPHRASE too
+	sequencer->muteChannelHeld = 0;
+	sequencer->appendPhraseHeld = 0;
+}
+
+static void PadAppendPhraseUp(struct Sequencer *sequencer, u8 index)
+{
+	sequencer->appendPhraseHeld = 0;
+}
+
+static void PadStopUp(struct Sequencer *sequencer, u8 index)
+{
+	if(sequencer->stopHeld == 1)
+	{
+		CommandPush(&sequencer->commands, COMMAND_STOP, NOROUTE, 1, 0);
+	}
+	sequencer->stopHeld = 0;
+}
+
+//______________________________________________________________________________
+//
+// Handler tables, indexed by pad.  Buttons do the same thing on every screen,
+// the 8x8 grid does whatever the screen is for, and empty entries are ignored.
+//______________________________________________________________________________
+
+#define GRID_ROW(row, handler) \
+	[row * 10 + 1] = handler, [row * 10 + 2] = handler, [row * 10 + 3] = handler, [row * 10 + 4] = handler, \
+	[row * 10 + 5] = handler, [row * 10 + 6] = handler, [row * 10 + 7] = handler, [row * 10 + 8] = handler
+
+#define GRID(handler) \
+	GRID_ROW(1, handler), GRID_ROW(2, handler), GRID_ROW(3, handler), GRID_ROW(4, handler), \
+	GRID_ROW(5, handler), GRID_ROW(6, handler), GRID_ROW(7, handler), GRID_ROW(8, handler)
+
+#define BUTTONS \
+	[ARRANGERSCREEN] = PadArrangerScreen, \
+	[NOTESCREEN] = PadNoteScreen, \
+	[SCENESCREEN] = PadScreen, \
+	[PLAYSONG] = PadPlay, \
+	[STOPSONG] = PadStop, \
+	[NEXTSCALE] = PadNextScale, \
+	[UNDO] = PadUndo, \
+	[REDO] = PadRedo, \
+	[TEMPODOWN] = PadTempoDown, \
+	[TEMPOUP] = PadTempoUp, \
+	[RELEASEDOWN] = PadReleaseDown, \
+	[RELEASEUP] = PadReleaseUp, \
+	[BANK] = PadBank, \
+	[REMOVEPHRASE] = PadRemovePhrase, \
+	[APPENDPHRASE] = PadAppendPhrase, \
+	[MUTECHANNEL] = PadMuteChannel, \
+	[PAGEUP] = PadPageUp, \
+	[PAGEDOWN] = PadPageDown, \
+	[PAGELEFT] = PadPageLeft, \
+	[PAGERIGHT] = PadPageRight, \
+	[CHANNEL0] = PadChannel, \
+	[CHANNEL1] = PadChannel, \
+	[CHANNEL2] = PadChannel, \
+	[CHANNEL3] = PadChannel, \
+	[MUTEVOICE0] = PadMuteVoice, \
+	[MUTEVOICE1] = PadMuteVoice, \
+	[MUTEVOICE2] = PadMuteVoice, \
+	[MUTEVOICE3] = PadMuteVoice, \
+	[MUTEVOICE4] = PadMuteVoice, \
+	[MUTEVOICE5] = PadMuteVoice, \
+	[MUTEVOICE6] = PadMuteVoice, \
+	[MUTEVOICE7] = PadMuteVoice
+
+static const PadHandler OVERVIEW_PRESS[PAD_INDICES] = { BUTTONS, GRID(PadOverview) };
+static const PadHandler ARRANGER_PRESS[PAD_INDICES] = { BUTTONS, GRID(PadArranger) };
+static const PadHandler NOTE_PRESS[PAD_INDICES] = { BUTTONS, GRID(PadNote) };
+static const PadHandler SCENE_PRESS[PAD_INDICES] = { BUTTONS, GRID_ROW(8, PadScene) };
+
+static const PadHandler RELEASE[PAD_INDICES] =
+{
+	[MUTECHANNEL] = PadMuteChannelUp,
+	[APPENDPHRASE] = PadAppendPhraseUp,
+	[STOPSONG] = PadStopUp,
+};
+
+// press tables by mode
+static const PadHandler *const PRESS[] =
+{
+	[OVERVIEWSCREEN] = OVERVIEW_PRESS,
+	[ARRANGERSCREEN] = ARRANGER_PRESS,
+	[NOTESCREEN] = NOTE_PRESS,
+	[SCENESCREEN] = SCENE_PRESS,
+};
+
+//______________________________________________________________________________
+
+// tell the timer a callback has queued something, once it's been published,
+// so the next tick between clock pulses looks at the queues
+static inline void Wake(struct Sequencer *sequencer)
+{
+	__sync_synchronize();
+	sequencer->waiting = 1;
+}
+
+static void Surface(struct Sequencer *sequencer, u8 type, u8 index, u8 value)
+{
+	TraceRecord(&sequencer->trace, TRACE_SURFACE, type, index, value);
+
+    switch (type)
+    {
+        case  TYPEPAD:
+        {
+			PadHandler handler = value ? PRESS[sequencer->mode][index] : RELEASE[index];
+
+			if (handler)
+			{
+				handler(sequencer, index);
+			}
+        }
+        break;
+
+        case TYPESETUP:
+        {
+            if (value)
+            {
+                // save button states to flash (reload them by power cycling the hardware!)
+                //hal_write_flash(0, g_Buttons, BUTTON_COUNT);
+            }
+        }
+        break;
+    }
+}
+
+//______________________________________________________________________________
+//
+// Step record.  Note-ons from a keyboard only set a voice flag in the chord,
+// however many arrive, and the timer writes the chord to the cursor as edits
+// on a tick between steps, once CHORDWINDOW has passed since it opened.
+//______________________________________________________________________________
+
+// find the current instrument's voice for a note, and add it to the chord
+static void RecordNote(struct Sequencer *sequencer, u8 note)
+{
+	struct Record *record = &sequencer->record;
+	struct Instrument *current = Current(sequencer);
+	u8 lowest = 0xFF;
+	u8 highest = 0;
+
+	for (u8 voice = 0; voice < RANGE; voice++)
+	{
+		if (!IsNoteOn(current->playable, voice))
+		{
+			continue;
+		}
+		if (current->noteMap[voice] == note)
+		{
+			__atomic_fetch_or(&record->chord[VOICEWORD(voice)], VOICEBIT(voice), __ATOMIC_RELEASE);
+
+			// opening the chord after adding to it means the timer can't take
+			// the chord between the two and miss the note
+			if (!record->open)
+			{
+				record->opened = sequencer->now;
+				record->open = 1;
+			}
+			return;
+		}
+		if (current->noteMap[voice] < lowest)
+		{
+			lowest = current->noteMap[voice];
+		}
+		if (current->noteMap[voice] > highest)
+		{
+			highest = current->noteMap[voice];
+		}
+	}
+
+	if (note < lowest)
+	{
+		record->missed |= MISSEDBELOW;
+	}
+	else if (note > highest)
+	{
+		record->missed |= MISSEDABOVE;
+	}
+	else
+	{
+		record->missed |= MISSEDSCALE;
+	}
+}
+
+// write the chord once its window has closed, and move the cursor on
+static RAMFUNC void RecordFlush(struct Sequencer *sequencer)
+{
+	struct Record *record = &sequencer->record;
+	u8 written = 0;
+
+	if (!record->open || (u16)(sequencer->now - record->opened) < CHORDWINDOW)
+	{
+		return;
+	}
+
+	// closed before it's taken, so a note arriving meanwhile opens the next
+	record->open = 0;
+	__sync_synchronize();
+
+	for (u8 word = 0; word < VOICEWORDS; word++)
+	{
+		u32 voices = __atomic_exchange_n(&record->chord[word], 0, __ATOMIC_ACQUIRE);
+
+		while (voices)
+		{
+			u8 bit = __builtin_ctz(voices);
+
+			voices &= voices - 1;
+			CommandApply(sequencer, COMMAND_SET_STEP, sequencer->currentInstrument, record->step, (word * 32) + bit);
+			written = 1;
+		}
+	}
+
+	if (written)
+	{
+		record->missed = 0;
+		record->step = (record->step + 1) % (PHRASES * STEPS);
+
+		// the note screen follows the cursor into the next phrase
+		Current(sequencer)->phraseView = (record->step / STEPS) + 1;
+	}
+}
+
+//______________________________________________________________________________
+
+// the commands carry the port the message came in on, so it isn't sent back
+static void Follow(struct Sequencer *sequencer, u8 port, u8 status, u8 d1, u8 d2)
+{
+	switch (status)
+	{
+		case MIDISTART:
+		{
+			CommandPush(&sequencer->midiCommands, COMMAND_STOP, port, 0, 0);
+			CommandPush(&sequencer->midiCommands, COMMAND_SEEK, port, 0, 0);
+			CommandPush(&sequencer->midiCommands, COMMAND_PLAY, port, 0, 0);
+		}
+		break;
+		case MIDICONTINUE:
+		{
+			CommandPush(&sequencer->midiCommands, COMMAND_PLAY, port, 0, 0);
+		}
+		break;
+		case MIDISTOP:
+		{
+			CommandPush(&sequencer->midiCommands, COMMAND_STOP, port, 0, 0);
+		}
+		break;
+		case SONGPOSITIONPOINTER:
+		{
+			CommandPush(&sequencer->midiCommands, COMMAND_SEEK, port, d1, d2);
+		}
+		break;
+	}
+}
+
+static void Midi(struct Sequencer *sequencer, u8 port, u8 status, u8 d1, u8 d2)
+{
+	TraceRecord(&sequencer->trace, TRACE_MIDI_IN | port, status, d1, d2);
+
+	// notes on a channel an instrument transposes from move the instruments
+	// listening to it, and don't go any further - other channels pass thru
+	if ((status & 0xF0) == NOTEON || (status & 0xF0) == NOTEOFF)
+	{
+		for (u8 i = 0; i < NUMINSTRUMENTS; i++)
+		{
+			if (sequencer->instruments[i].transposeChannel == (status & 0x0F))
+			{
+				if ((status & 0xF0) == NOTEON && d2 != 0)
+				{
+					CommandPush(&sequencer->midiCommands, COMMAND_TRANSPOSE, 0, status & 0x0F, d1);
+				}
+				return;
+			}
+		}
+	}
+
+	// follow transport messages from ports that haven't filtered them out, and
+	// don't pass them on - the sequencer sends its own
+	if (status == MIDISTART || status == MIDICONTINUE || status == MIDISTOP || status == SONGPOSITIONPOINTER)
+	{
+		if (port < THRU_PORTS && !(sequencer->thru.ports[port].filter & THRU_TRANSPORT))
+		{
+			Follow(sequencer, port, status, d1, d2);
+		}
+		return;
+	}
+
+	// while step recording, notes go into the chord as well as through
+	if (sequencer->record.on && (status & 0xF0) == NOTEON && d2 != 0)
+	{
+		RecordNote(sequencer, d1);
+	}
+
+	ThruMidi(&sequencer->thru, port, status, d1, d2);
+}
+
+//______________________________________________________________________________
+
+static void Sysex(struct Sequencer *sequencer, u8 port, u8 *data, u16 count)
+{
+	TraceRecord(&sequencer->trace, TRACE_SYSEX_IN | port, count & 0x7F, count >> 7, 0);
+
+	if (count < SYSEX_HEADER_SIZE + 1 || data[1] != SYSEX_MANUFACTURER)
+	{
+		ThruSysex(&sequencer->thru, port, data, count);
+		return;
+	}
+
+	switch (data[2])
+	{
+		case SYSEX_THRU_CONFIG:
+		{
+			ThruConfigure(&sequencer->thru, data, count);
+		}
+		break;
+		case SYSEX_PRESSURE_CONFIG:
+		{
+			PressureConfigure(&sequencer->pressure, data, count);
+		}
+		break;
+		case SYSEX_TRACE_REQUEST:
+		{
+			// the counters have nowhere else to go, so they end the dump
+			TraceRecord(&sequencer->trace, TRACE_COUNTERS, sequencer->thru.dropped, sequencer->pressure.suppressed >> 8, sequencer->pressure.suppressed & 0xFF);
+			TraceDump(&sequencer->trace, port);
+		}
+		break;
+		case SYSEX_STATE_REQUEST:
+		{
+			StateRequest(sequencer, port);
+		}
+		break;
+		default:
+		{
+			StateQueue(sequencer, port, data, count);
+		}
+		break;
+	}
+}
+
+//______________________________________________________________________________
+
+void SequencerSurface(struct Sequencer *sequencer, u8 type, u8 index, u8 value)
+{
+	Surface(sequencer, type, index, value);
+	Wake(sequencer);
+}
+
+void SequencerMidi(struct Sequencer *sequencer, u8 port, u8 status, u8 d1, u8 d2)
+{
+	Midi(sequencer, port, status, d1, d2);
+	Wake(sequencer);
+}
+
+void SequencerSysex(struct Sequencer *sequencer, u8 port, u8 *data, u16 count)
+{
+	Sysex(sequencer, port, data, count);
+	Wake(sequencer);
+}
+
+void SequencerAftertouch(struct Sequencer *sequencer, u8 index, u8 value)
+{
+	PressureSample(&sequencer->pressure, index, value);
+	Wake(sequencer);
+}
+
+// anything the flushes left for a later tick - thru over its budget, pressure
+// waiting out its interval, a chord still gathering or a dump going out
+static RAMFUNC u8 Unfinished(struct Sequencer *sequencer)
+{
+	u32 pressure = 0;
+
+	for (u8 word = 0; word < PRESSURE_WORDS; word++)
+	{
+		pressure |= sequencer->pressure.pending[word];
+	}
+
+	return pressure || sequencer->thru.head != sequencer->thru.tail || sequencer->thru.sysexPending || sequencer->record.open || sequencer->dump.requested || sequencer->dump.next < DUMPMESSAGES;
+}
+
+RAMFUNC void SequencerTimer(struct Sequencer *sequencer)
+{
+	sequencer->trace.time = ++sequencer->now;
+
+	// clock pulses, note offs, steps and LED animation all happen on a pulse,
+	// and between them there's only work to do once a callback has queued some
+	if ((s16)(sequencer->now - sequencer->nextClock) < 0)
+	{
+		if (!sequencer->waiting)
+		{
+			return;
+		}
+		sequencer->waiting = 0;
+		__sync_synchronize();
+
+		CommandsApply(sequencer);
+		StateFlush(sequencer);
+		ThruFlush(sequencer);
+		PressureFlush(sequencer);
+		RecordFlush(sequencer);
+		StateSend(sequencer);
+
+		if (Unfinished(sequencer))
+		{
+			sequencer->waiting = 1;
+		}
+		return;
+	}
+
+	CommandsApply(sequencer);
+	StateFlush(sequencer);
+
+	struct Instrument *current = &sequencer->instruments[sequencer->currentInstrument];
+	u32 startCycles = TraceCycles();
+
+	sequencer->lastClock = sequencer->now;
+	sequencer->nextClock = sequencer->now + sequencer->msPerTick;
+
+	// clock goes out of every port, as transport does, so anything that starts
+	// with the sequencer also keeps time with it
+	for(u8 port = USBSTANDALONE; port <= DINMIDI; port++)
+	{
+		hal_send_midi(port, MIDITIMINGCLOCK, 0, 0);
+	}
+
+	if (++sequencer->semiquaverInterval >= 6)
+	{
+		sequencer->semiquaverInterval = 0;
+		u8 i;
+
+		// while stopped the display keeps updating, but nothing moves
+		if (sequencer->playing)
+		{
+			if (sequencer->barStep >= BAR_STEPS)
+			{
+				sequencer->barStep = 0;
+				if (sequencer->nextScene != NOSCENE)
+				{
+					SwitchScene(sequencer);
+				}
+				if (sequencer->transposePending)
+				{
+					LatchTranspose(sequencer);
+				}
+			}
+
+			if (sequencer->step >= STEPS)
+			{
+				sequencer->step = 0;
+				for(i = 0; i < NUMINSTRUMENTS; i++)
+				{
+					IncrementSequence(&sequencer->instruments[i], sequencer->arrangement->length[i]);
+					TraceRecord(&sequencer->trace, TRACE_PHRASE, i, sequencer->instruments[i].phrase, sequencer->arrangement->sequence[i][sequencer->instruments[i].phrase]);
+				}
+			}
+
+			TraceRecord(&sequencer->trace, TRACE_STEP, sequencer->step, sequencer->arrangement->tempo, 0);
+		}
+
+		PlotClear();
+
+		if (sequencer->refusedFlash)
+		{
+			sequencer->refusedFlash--;
+		}
+
+		if (sequencer->playing)
+		{
+			// instruments with nothing in their sequence cost nothing, once
+			// their notes have stopped
+			u32 active = sequencer->arrangement->active | sequencer->ringing;
+
+			while (active)
+			{
+				i = __builtin_ctz(active);
+				active &= active - 1;
+				TriggerNotes(sequencer, &sequencer->instruments[i], sequencer->step, i);
+			}
+		}
+
+		u8 bank = sequencer->currentInstrument - (sequencer->currentInstrument % BANKSIZE);
+		for(i = bank; i < bank + BANKSIZE && i < NUMINSTRUMENTS; i++)
+		{
+			PlotButtons(&sequencer->instruments[i], sequencer->arrangement->isMuted[i], sequencer->currentInstrument == i);
+		}
+		PlotBank(bank / BANKSIZE);
+		PlotTransport(sequencer);
+		PlotJournal(&sequencer->journal);
+
+		switch(sequencer->mode)
+		{
+			case OVERVIEWSCREEN:
+			{
+				PlotOverview(sequencer);
+			}
+			break;
+			case ARRANGERSCREEN:
+			{
+				PlotPhrases(current);
+
+				PlotSequence(sequencer, current, sequencer->arrangement->sequence[sequencer->currentInstrument], sequencer->arrangement->length[sequencer->currentInstrument]);
+			}
+			break;
+			case NOTESCREEN:
+			{
+				PlotRoots(current);
+
+				if(sequencer->playing && sequencer->arrangement->sequence[sequencer->currentInstrument][current->phrase] == current->phraseView)
+				{
+					PlotPlayhead(sequencer->step);
+				}
+
+				if(sequencer->record.on)
+				{
+					PlotCursor(&sequencer->record, current);
+				}
+
+				PlotNotes(&sequencer->pool, current);
+				PlotRefused(sequencer, current);
+			}
+			break;
+			case SCENESCREEN:
+			{
+				PlotScenes(sequencer);
+			}
+			break;
+		}
+
+		if (sequencer->playing)
+		{
+			sequencer->step++;
+			sequencer->barStep++;
+			sequencer->position++;
+		}
+	}
+	else
+	{
+		// thru traffic goes out behind the clock, and on a step it waits a
+		// tick so the notes go first
+		ThruFlush(sequencer);
+		PressureFlush(sequencer);
+		RecordFlush(sequencer);
+	}
+
+	TraceCheckOverrun(&sequencer->trace, startCycles);
+}
+
+//______________________________________________________________________________
+
+void SequencerLocate(struct Sequencer *sequencer, u16 position)
+{
+	u16 phrase = position / STEPS;
+
+	for(u8 i = 0; i < NUMINSTRUMENTS; i++)
+	{
+		u8 length = sequencer->arrangement->length[i];
+
+		sequencer->instruments[i].phrase = length ? phrase % length : 0;
+	}
+	sequencer->step = position % STEPS;
+	sequencer->barStep = position % BAR_STEPS;
+	sequencer->position = position;
+}
+
+// transport goes out of every port, so something following the sequencer
+// over USB starts, stops and locates with it as well as anything on DIN -
+// except the one it came in on, if it came in, which already knows
+static void SendTransport(struct Sequencer *sequencer, u8 from, u8 status, u8 d1, u8 d2)
+{
+	for(u8 port = USBSTANDALONE; port <= DINMIDI; port++)
+	{
+		if(port != from)
+		{
+			SendMidi(sequencer, port, status, d1, d2);
+		}
+	}
+}
+
+void SequencerPlay(struct Sequencer *sequencer, u8 from)
+{
+	if(sequencer->playing)
+	{
+		return;
+	}
+
+	SendTransport(sequencer, from, sequencer->position ? MIDICONTINUE : MIDISTART, 0, 0);
+	sequencer->playing = 1;
+
+	// the next clock pulse is the first beat
+	sequencer->semiquaverInterval = 5;
+}
+
+void SequencerStop(struct Sequencer *sequencer, u8 from)
+{
+	if(!sequencer->playing)
+	{
+		return;
+	}
+
+	SendTransport(sequencer, from, MIDISTOP, 0, 0);
+	sequencer->playing = 0;
+
+	for(u8 i = 0; i < NUMINSTRUMENTS; i++)
+	{
+		SilenceInstrument(sequencer, &sequencer->instruments[i]);
+	}
+}
+
+void SilenceInstrument(struct Sequencer *sequencer, struct Instrument *instrument)
+{
+	for(u8 note = 0; note < RANGE; note++)
+	{
+		if(IsNoteOn(instrument->sounding, note))
+		{
+			for (u8 d = 0; d < instrument->destinationCount; d++)
+			{
+				SendMidi(sequencer, instrument->destinations[d].port, instrument->destinations[d].noteOff, instrument->soundingNotes[note], 0);
+			}
+		}
+		instrument->sustainStates[note] = 0;
+	}
+	for(u8 word = 0; word < VOICEWORDS; word++)
+	{
+		instrument->sounding[word] = 0;
+	}
+}
+
+void SequencerSeek(struct Sequencer *sequencer, u16 position, u8 from)
+{
+	// song position can't change while playing, so stop, move and continue
+	u8 playing = sequencer->playing;
+
+	SequencerStop(sequencer, from);
+	SequencerLocate(sequencer, position);
+	SendTransport(sequencer, from, SONGPOSITIONPOINTER, position & 0x7F, (position >> 7) & 0x7F);
+
+	if(playing)
+	{
+		SequencerPlay(sequencer, from);
+	}
+}
+
+void SequencerInit(struct Sequencer *sequencer)
+{
+	for(u8 i = 0; i < SCENES; i++)
+	{
+		sequencer->scenes[i].tempo = DEFAULTTEMPO;
+	}
+	sequencer->arrangement = &sequencer->scenes[0];
+	sequencer->nextScene = NOSCENE;
+	sequencer->dump.next = DUMPMESSAGES;
+
+    // calculate how many milliseconds per tick for midi clock
+    CalculateMsPerClock(sequencer, DEFAULTTEMPO);
+
+	sequencer->mode = ARRANGERSCREEN;
+	sequencer->currentInstrument = INSTRUMENT0;
+
+	MakeInstruments(sequencer);
+	ThruInit(&sequencer->thru);
+	PressureInit(&sequencer->pressure);
+	SequencerPlay(sequencer, NOROUTE);
+}
@@ -0,0 +1,507 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+//______________________________________________________________________________
+//
+// Headers
+//______________________________________________________________________________
+
+#include "app.h"
+#include "command.h"
+#include "ramfunc.h"
+#include "state.h"
+#include "sysex.h"
+
+//______________________________________________________________________________
+
+#define VOICES_SIZE (VOICEWORDS * 4) // a set of voice flags, little endian u32s
+#define GLOBAL_STATE_SIZE (1 + SCENES)
+#define INSTRUMENT_ROUTES (1 + VOICES_SIZE) // offset of the routes in the instrument state
+#define INSTRUMENT_STATE_SIZE (INSTRUMENT_ROUTES + (ROUTES * 2) + 3)
+#define NOTEMAP_STATE_SIZE RANGE
+#define PHRASE_STATE_SIZE (STEPS * VOICES_SIZE)
+#define ARRANGEMENT_STATE_SIZE (PHRASES + 1)
+#define LARGEST_STATE_SIZE (PHRASE_STATE_SIZE > ARRANGEMENT_STATE_SIZE ? PHRASE_STATE_SIZE : ARRANGEMENT_STATE_SIZE)
+
+// dumps from before scenes - one tempo, and each instrument's arrangement and
+// mute alongside its other settings - still load into the playing scene
+#define OLD_GLOBAL_STATE_SIZE 1
+#define OLD_INSTRUMENT_STATE_SIZE (PHRASES + 6)
+
+// and dumps from before routing keep the routes the instrument already has,
+// as dumps from before base notes keep LOWESTNOTE, from before scales stay
+// chromatic, and from before live transpose keep their transpose channel.  Those, and dumps from
+// builds with one VOICEWORDS, have 32 voices which load into the lowest.
+#define UNROUTED_INSTRUMENT_STATE_SIZE 5
+#define UNPITCHED_INSTRUMENT_STATE_SIZE (5 + (ROUTES * 2))
+#define UNSCALED_INSTRUMENT_STATE_SIZE (INSTRUMENT_ROUTES + (ROUTES * 2) + 1)
+#define UNTRANSPOSED_INSTRUMENT_STATE_SIZE (INSTRUMENT_ROUTES + (ROUTES * 2) + 2)
+#define NARROW_PHRASE_STATE_SIZE (STEPS * 4)
+
+typedef char LoadsHoldEveryMessage[SYSEX_HEADER_SIZE + 2 + SYSEX_PACKED_SIZE(OLD_INSTRUMENT_STATE_SIZE > LARGEST_STATE_SIZE ? OLD_INSTRUMENT_STATE_SIZE : LARGEST_STATE_SIZE) + 1 <= LOADSIZE ? 1 : -1];
+
+static void PutU32(u8 *out, u32 value)
+{
+	out[0] = value;
+	out[1] = value >> 8;
+	out[2] = value >> 16;
+	out[3] = value >> 24;
+}
+
+static u32 GetU32(const u8 *in)
+{
+	return in[0] | ((u32)in[1] << 8) | ((u32)in[2] << 16) | ((u32)in[3] << 24);
+}
+
+static void PutVoices(u8 *out, const u32 *voices)
+{
+	for (u8 word = 0; word < VOICEWORDS; word++)
+	{
+		PutU32(&out[word * 4], voices[word]);
+	}
+}
+
+// load the first words of a set of voice flags, and clear the rest
+static void GetVoices(u32 *voices, const u8 *in, u8 words)
+{
+	for (u8 word = 0; word < VOICEWORDS; word++)
+	{
+		voices[word] = word < words ? GetU32(&in[word * 4]) : 0;
+	}
+}
+
+static void SendState(u8 port, u8 command, const u8 *address, u8 addressLength, const u8 *payload, u16 payloadLength)
+{
+	u8 message[SYSEX_HEADER_SIZE + 2 + SYSEX_PACKED_SIZE(LARGEST_STATE_SIZE) + 1];
+	u16 length = 0;
+
+	message[length++] = SYSEX_START;
+	message[length++] = SYSEX_MANUFACTURER;
+	message[length++] = command;
+	for (u8 i = 0; i < addressLength; i++)
+	{
+		message[length++] = address[i];
+	}
+	length += SysexPack(payload, payloadLength, &message[length]);
+	message[length++] = SYSEX_END;
+
+	hal_send_sysex(port, message, length);
+}
+
+// the sequence ends at the first 0, or at anything that isn't a phrase
+static u8 LoadSequence(u8 *sequence, const u8 *payload)
+{
+	u8 length = 0;
+
+	while (length < PHRASES && payload[length] != 0 && payload[length] <= PHRASES)
+	{
+		sequence[length] = payload[length];
+		length++;
+	}
+	for (u8 j = length; j < PHRASES; j++)
+	{
+		sequence[j] = 0;
+	}
+
+	return length;
+}
+
+// send message n of a dump - the global message, then each instrument's
+// settings, note map and phrases, then each scene's arrangements
+static void DumpMessage(struct Sequencer *sequencer, u8 port, u16 n)
+{
+	u8 payload[LARGEST_STATE_SIZE];
+
+	if (n == 0)
+	{
+		payload[0] = sequencer->arrangement - sequencer->scenes;
+		for (u8 scene = 0; scene < SCENES; scene++)
+		{
+			payload[1 + scene] = sequencer->scenes[scene].tempo;
+		}
+		SendState(port, SYSEX_STATE_GLOBAL, 0, 0, payload, GLOBAL_STATE_SIZE);
+		return;
+	}
+	n--;
+
+	if (n < NUMINSTRUMENTS * (PHRASES + 2))
+	{
+		u8 i = n / (PHRASES + 2);
+		u8 part = n % (PHRASES + 2);
+		struct Instrument *instrument = &sequencer->instruments[i];
+
+		if (part == 0)
+		{
+			payload[0] = instrument->sustain;
+			PutVoices(&payload[1], instrument->mutedVoices);
+			for (u8 route = 0; route < ROUTES; route++)
+			{
+				payload[INSTRUMENT_ROUTES + (route * 2)] = instrument->routes[route].port;
+				payload[INSTRUMENT_ROUTES + 1 + (route * 2)] = instrument->routes[route].channel;
+			}
+			payload[INSTRUMENT_ROUTES + (ROUTES * 2)] = instrument->baseNote;
+			payload[INSTRUMENT_ROUTES + (ROUTES * 2) + 1] = instrument->scale;
+			payload[INSTRUMENT_ROUTES + (ROUTES * 2) + 2] = instrument->transposeChannel;
+			SendState(port, SYSEX_STATE_INSTRUMENT, &i, 1, payload, INSTRUMENT_STATE_SIZE);
+		}
+		else if (part == 1)
+		{
+			SendState(port, SYSEX_STATE_NOTEMAP, &i, 1, instrument->customMap, NOTEMAP_STATE_SIZE);
+		}
+		else
+		{
+			u8 address[2] = {i, part - 2};
+
+			for (u8 step = 0; step < STEPS; step++)
+			{
+				PutVoices(&payload[step * VOICES_SIZE], &sequencer->pool.steps[instrument->phrases[part - 2]][step * VOICEWORDS]);
+			}
+			SendState(port, SYSEX_STATE_PHRASE, address, 2, payload, PHRASE_STATE_SIZE);
+		}
+		return;
+	}
+	n -= NUMINSTRUMENTS * (PHRASES + 2);
+
+	u8 address[2] = {n / NUMINSTRUMENTS, n % NUMINSTRUMENTS};
+	struct Arrangement *arrangement = &sequencer->scenes[address[0]];
+
+	for (u8 j = 0; j < PHRASES; j++)
+	{
+		payload[j] = arrangement->sequence[address[1]][j];
+	}
+	payload[PHRASES] = arrangement->isMuted[address[1]];
+	SendState(port, SYSEX_STATE_ARRANGEMENT, address, 2, payload, ARRANGEMENT_STATE_SIZE);
+}
+
+void StateDump(struct Sequencer *sequencer, u8 port)
+{
+	for (u16 n = 0; n < DUMPMESSAGES; n++)
+	{
+		DumpMessage(sequencer, port, n);
+	}
+}
+
+void StateRequest(struct Sequencer *sequencer, u8 port)
+{
+	sequencer->dump.port = port;
+	__sync_synchronize();
+	sequencer->dump.requested = 1;
+}
+
+RAMFUNC void StateSend(struct Sequencer *sequencer)
+{
+	struct Dump *dump = &sequencer->dump;
+
+	// a request while a dump is going starts it again
+	if (dump->requested)
+	{
+		dump->requested = 0;
+		dump->next = 0;
+	}
+
+	if (dump->next < DUMPMESSAGES)
+	{
+		DumpMessage(sequencer, dump->port, dump->next++);
+	}
+}
+
+u8 StateLoad(struct Sequencer *sequencer, const u8 *data, u16 count)
+{
+	u8 payload[(OLD_INSTRUMENT_STATE_SIZE > LARGEST_STATE_SIZE ? OLD_INSTRUMENT_STATE_SIZE : LARGEST_STATE_SIZE) + 7];
+
+	if (count < SYSEX_HEADER_SIZE + 1 || data[1] != SYSEX_MANUFACTURER)
+	{
+		return SYSEX_REFUSED_INVALID;
+	}
+
+	// everything between the header and F7
+	const u8 *body = &data[SYSEX_HEADER_SIZE];
+	u16 bodyLength = count - SYSEX_HEADER_SIZE - 1;
+
+	switch (data[2])
+	{
+		case SYSEX_STATE_GLOBAL:
+		{
+			if (bodyLength == SYSEX_PACKED_SIZE(OLD_GLOBAL_STATE_SIZE))
+			{
+				SysexUnpack(body, bodyLength, payload);
+				CalculateMsPerClock(sequencer, payload[0]);
+				break;
+			}
+			if (bodyLength != SYSEX_PACKED_SIZE(GLOBAL_STATE_SIZE))
+			{
+				return SYSEX_REFUSED_INVALID;
+			}
+			SysexUnpack(body, bodyLength, payload);
+			for (u8 scene = 0; scene < SCENES; scene++)
+			{
+				if (payload[1 + scene] >= MINTEMPO)
+				{
+					sequencer->scenes[scene].tempo = payload[1 + scene];
+				}
+			}
+			if (payload[0] < SCENES)
+			{
+				sequencer->arrangement = &sequencer->scenes[payload[0]];
+			}
+			CalculateMsPerClock(sequencer, sequencer->arrangement->tempo);
+		}
+		break;
+		case SYSEX_STATE_INSTRUMENT:
+		{
+			if (bodyLength < 1 || body[0] >= NUMINSTRUMENTS)
+			{
+				return SYSEX_REFUSED_INVALID;
+			}
+			struct Instrument *instrument = &sequencer->instruments[body[0]];
+
+			if (bodyLength == 1 + SYSEX_PACKED_SIZE(OLD_INSTRUMENT_STATE_SIZE))
+			{
+				SysexUnpack(&body[1], bodyLength - 1, payload);
+				SetSequenceLength(sequencer->arrangement, body[0], LoadSequence(sequencer->arrangement->sequence[body[0]], payload));
+				instrument->sustain = payload[PHRASES];
+				sequencer->arrangement->isMuted[body[0]] = payload[PHRASES + 1];
+				GetVoices(instrument->mutedVoices, &payload[PHRASES + 2], 1);
+				break;
+			}
+
+			u8 words = VOICEWORDS;
+			u8 routed = 1;
+			u8 pitched = 1;
+			u8 scaled = 1;
+			u8 transposed = 1;
+
+			if (bodyLength == 1 + SYSEX_PACKED_SIZE(UNROUTED_INSTRUMENT_STATE_SIZE))
+			{
+				words = 1;
+				routed = 0;
+				pitched = 0;
+				scaled = 0;
+				transposed = 0;
+			}
+			else if (bodyLength == 1 + SYSEX_PACKED_SIZE(UNPITCHED_INSTRUMENT_STATE_SIZE))
+			{
+				words = 1;
+				pitched = 0;
+				scaled = 0;
+				transposed = 0;
+			}
+			else if (bodyLength == 1 + SYSEX_PACKED_SIZE(UNSCALED_INSTRUMENT_STATE_SIZE))
+			{
+				scaled = 0;
+				transposed = 0;
+			}
+			else if (bodyLength == 1 + SYSEX_PACKED_SIZE(UNTRANSPOSED_INSTRUMENT_STATE_SIZE))
+			{
+				transposed = 0;
+			}
+			else if (bodyLength != 1 + SYSEX_PACKED_SIZE(INSTRUMENT_STATE_SIZE))
+			{
+				return SYSEX_REFUSED_INVALID;
+			}
+			SysexUnpack(&body[1], bodyLength - 1, payload);
+
+			const u8 *routes = &payload[1 + (words * 4)];
+
+			instrument->sustain = payload[0];
+			GetVoices(instrument->mutedVoices, &payload[1], words);
+			if (routed)
+			{
+				u8 moved = 0;
+
+				for (u8 route = 0; route < ROUTES; route++)
+				{
+					moved |= instrument->routes[route].port != routes[route * 2] || instrument->routes[route].channel != routes[(route * 2) + 1];
+				}
+				if (moved)
+				{
+					// notes already sounding are stopped where they were started
+					SilenceInstrument(sequencer, instrument);
+					for (u8 route = 0; route < ROUTES; route++)
+					{
+						instrument->routes[route].port = routes[route * 2];
+						instrument->routes[route].channel = routes[(route * 2) + 1];
+					}
+					RouteInstrument(instrument);
+				}
+			}
+			if (pitched && routes[ROUTES * 2] < 128)
+			{
+				instrument->baseNote = routes[ROUTES * 2];
+			}
+			if (scaled && routes[(ROUTES * 2) + 1] < NUMSCALES)
+			{
+				instrument->scale = routes[(ROUTES * 2) + 1];
+			}
+			if (transposed)
+			{
+				instrument->transposeChannel = routes[(ROUTES * 2) + 2] < 16 ? routes[(ROUTES * 2) + 2] : NOTRANSPOSE;
+			}
+			MapNotes(instrument);
+		}
+		break;
+		case SYSEX_STATE_PHRASE:
+		{
+			u8 words = VOICEWORDS;
+
+			if (bodyLength == 2 + SYSEX_PACKED_SIZE(NARROW_PHRASE_STATE_SIZE))
+			{
+				words = 1;
+			}
+			else if (bodyLength != 2 + SYSEX_PACKED_SIZE(PHRASE_STATE_SIZE))
+			{
+				return SYSEX_REFUSED_INVALID;
+			}
+			if (body[0] >= NUMINSTRUMENTS || body[1] >= PHRASES)
+			{
+				return SYSEX_REFUSED_INVALID;
+			}
+			u32 steps[STEPS * VOICEWORDS];
+
+			SysexUnpack(&body[2], bodyLength - 2, payload);
+			for (u8 step = 0; step < STEPS; step++)
+			{
+				GetVoices(&steps[step * VOICEWORDS], &payload[step * words * 4], words);
+			}
+
+			// phrases that are the same share a slot again, as they did when saved
+			if (!PhraseStore(sequencer, &sequencer->instruments[body[0]], body[1], steps))
+			{
+				return SYSEX_REFUSED_FULL;
+			}
+		}
+		break;
+		case SYSEX_STATE_NOTEMAP:
+		{
+			if (bodyLength != 1 + SYSEX_PACKED_SIZE(NOTEMAP_STATE_SIZE) || body[0] >= NUMINSTRUMENTS)
+			{
+				return SYSEX_REFUSED_INVALID;
+			}
+			struct Instrument *instrument = &sequencer->instruments[body[0]];
+
+			SysexUnpack(&body[1], bodyLength - 1, instrument->customMap);
+			MapNotes(instrument);
+		}
+		break;
+		case SYSEX_STATE_ARRANGEMENT:
+		{
+			if (bodyLength != 2 + SYSEX_PACKED_SIZE(ARRANGEMENT_STATE_SIZE) || body[0] >= SCENES || body[1] >= NUMINSTRUMENTS)
+			{
+				return SYSEX_REFUSED_INVALID;
+			}
+			struct Arrangement *arrangement = &sequencer->scenes[body[0]];
+
+			SysexUnpack(&body[2], bodyLength - 2, payload);
+			SetSequenceLength(arrangement, body[1], LoadSequence(arrangement->sequence[body[1]], payload));
+			arrangement->isMuted[body[1]] = payload[PHRASES];
+		}
+		break;
+		default:
+		{
+			return SYSEX_REFUSED_INVALID;
+		}
+	}
+
+	return 0;
+}
+
+// tell the host which message wasn't loaded, and why
+static void Refuse(u8 port, u8 reason, const u8 *data, u16 count)
+{
+	u8 message[] = {SYSEX_START, SYSEX_MANUFACTURER, SYSEX_STATE_REFUSED, reason, 0, 0, 0, SYSEX_END};
+
+	// the command, and the address if it has one, up to the F7
+	for (u16 i = 2; i < 5 && i + 1 < count; i++)
+	{
+		message[2 + i] = data[i];
+	}
+
+	hal_send_sysex(port, message, sizeof(message));
+}
+
+void StateQueue(struct Sequencer *sequencer, u8 port, const u8 *data, u16 count)
+{
+	struct Loads *loads = &sequencer->loads;
+	u8 head = loads->head;
+
+	if (count > LOADSIZE)
+	{
+		Refuse(port, SYSEX_REFUSED_INVALID, data, count);
+		return;
+	}
+	if ((u8)(head - loads->tail) >= LOADQUEUE)
+	{
+		Refuse(port, SYSEX_REFUSED_BUSY, data, count);
+		return;
+	}
+
+	struct Load *load = &loads->ring[head & (LOADQUEUE - 1)];
+
+	for (u16 i = 0; i < count; i++)
+	{
+		load->data[i] = data[i];
+	}
+	load->length = count;
+	load->port = port;
+
+	// the message must be complete before the timer can see it
+	__sync_synchronize();
+	loads->head = head + 1;
+}
+
+RAMFUNC void StateFlush(struct Sequencer *sequencer)
+{
+	struct Loads *loads = &sequencer->loads;
+	u8 tail = loads->tail;
+
+	while (tail != loads->head)
+	{
+		__sync_synchronize();
+		struct Load *load = &loads->ring[tail & (LOADQUEUE - 1)];
+
+		u8 reason = StateLoad(sequencer, load->data, load->length);
+
+		if (reason)
+		{
+			Refuse(load->port, reason, load->data, load->length);
+		}
+		else
+		{
+			// undoing an edit made before the load would apply it to the song that was loaded
+			JournalClear(sequencer);
+		}
+
+		// the slot is read in place, so it's only handed back once it's loaded
+		__sync_synchronize();
+		loads->tail = ++tail;
+	}
+}
@@ -0,0 +1,76 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+//______________________________________________________________________________
+//
+// Headers
+//______________________________________________________________________________
+
+#include "sysex.h"
+
+//______________________________________________________________________________
+
+u16 SysexPack(const u8 *data, u16 length, u8 *out)
+{
+	u16 written = 0;
+
+	for (u16 i = 0; i < length; i += 7)
+	{
+		u8 *msbs = &out[written++];
+		*msbs = 0;
+
+		for (u8 j = 0; j < 7 && i + j < length; j++)
+		{
+			*msbs |= (data[i + j] >> 7) << j;
+			out[written++] = data[i + j] & 0x7F;
+		}
+	}
+
+	return written;
+}
+
+u16 SysexUnpack(const u8 *data, u16 length, u8 *out)
+{
+	u16 written = 0;
+
+	for (u16 i = 0; i < length; i += 8)
+	{
+		u8 msbs = data[i];
+
+		for (u8 j = 0; j < 7 && i + j + 1 < length; j++)
+		{
+			out[written++] = data[i + j + 1] | (((msbs >> j) & 1) << 7);
+		}
+	}
+
+	return written;
+}
@@ -0,0 +1,206 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+//______________________________________________________________________________
+//
+// Headers
+//______________________________________________________________________________
+
+#include "app.h"
+#include "ramfunc.h"
+#include "sequencer.h"
+#include "sysex.h"
+#include "thru.h"
+
+//______________________________________________________________________________
+
+void ThruInit(struct Thru *thru)
+{
+	for (u8 port = 0; port < THRU_PORTS; port++)
+	{
+		thru->ports[port].destination = NOROUTE;
+		thru->ports[port].filter = THRU_SYSEX | THRU_CLOCK;
+		for (u8 channel = 0; channel < 16; channel++)
+		{
+			thru->ports[port].channels[channel] = channel;
+		}
+	}
+
+	thru->ports[USBMIDI].destination = DINMIDI;
+	thru->ports[DINMIDI].destination = USBMIDI;
+}
+
+u8 ThruConfigure(struct Thru *thru, const u8 *data, u16 count)
+{
+	if (count != SYSEX_HEADER_SIZE + 3 + 16 + 1 || data[SYSEX_HEADER_SIZE] >= THRU_PORTS)
+	{
+		return 0;
+	}
+
+	struct ThruPort *port = &thru->ports[data[SYSEX_HEADER_SIZE]];
+	const u8 *channels = &data[SYSEX_HEADER_SIZE + 3];
+
+	port->destination = data[SYSEX_HEADER_SIZE + 1] < THRU_PORTS ? data[SYSEX_HEADER_SIZE + 1] : NOROUTE;
+	port->filter = data[SYSEX_HEADER_SIZE + 2];
+	for (u8 channel = 0; channel < 16; channel++)
+	{
+		port->channels[channel] = channels[channel] & 0x0F;
+	}
+
+	return 1;
+}
+
+//______________________________________________________________________________
+
+void ThruMidi(struct Thru *thru, u8 port, u8 status, u8 d1, u8 d2)
+{
+	if (port >= THRU_PORTS)
+	{
+		return;
+	}
+
+	const struct ThruPort *from = &thru->ports[port];
+	u8 type;
+
+	if (from->destination == NOROUTE)
+	{
+		return;
+	}
+
+	switch (status & 0xF0)
+	{
+		case CC:
+		{
+			type = THRU_CC;
+		}
+		break;
+		case POLYAFTERTOUCH:
+		case CHANNELAFTERTOUCH:
+		{
+			type = THRU_AFTERTOUCH;
+		}
+		break;
+		default:
+		{
+			type = (status == MIDITIMINGCLOCK || status == MIDIACTIVESENSE) ? THRU_CLOCK : 0;
+		}
+		break;
+	}
+	if (from->filter & type)
+	{
+		return;
+	}
+
+	// system messages have no channel
+	if (status < 0xF0)
+	{
+		status = (status & 0xF0) | from->channels[status & 0x0F];
+	}
+
+	u8 head = thru->head;
+
+	if ((u8)(head - thru->tail) >= THRU_QUEUE_SIZE)
+	{
+		thru->dropped++;
+		return;
+	}
+
+	struct ThruMessage *message = &thru->ring[head & (THRU_QUEUE_SIZE - 1)];
+	message->port = from->destination;
+	message->status = status;
+	message->d1 = d1;
+	message->d2 = d2;
+
+	// the message must be complete before the timer can see it
+	__sync_synchronize();
+	thru->head = head + 1;
+}
+
+void ThruSysex(struct Thru *thru, u8 port, const u8 *data, u16 count)
+{
+	if (port >= THRU_PORTS)
+	{
+		return;
+	}
+
+	const struct ThruPort *from = &thru->ports[port];
+
+	if (from->destination == NOROUTE || (from->filter & THRU_SYSEX))
+	{
+		return;
+	}
+	if (thru->sysexPending || count > THRU_SYSEX_SIZE)
+	{
+		thru->dropped++;
+		return;
+	}
+
+	for (u16 i = 0; i < count; i++)
+	{
+		thru->sysex[i] = data[i];
+	}
+	thru->sysexLength = count;
+	thru->sysexPort = from->destination;
+
+	__sync_synchronize();
+	thru->sysexPending = 1;
+}
+
+//______________________________________________________________________________
+
+RAMFUNC void ThruFlush(struct Sequencer *sequencer)
+{
+	struct Thru *thru = &sequencer->thru;
+	u8 tail = thru->tail;
+	u8 budget = THRU_BUDGET;
+
+	if (tail == thru->head)
+	{
+		// a SysEx message waits for the short ones, then takes a tick to itself
+		if (thru->sysexPending)
+		{
+			hal_send_sysex(thru->sysexPort, thru->sysex, thru->sysexLength);
+			thru->sysexPending = 0;
+		}
+		return;
+	}
+
+	while (tail != thru->head && budget--)
+	{
+		const struct ThruMessage *message = &thru->ring[tail & (THRU_QUEUE_SIZE - 1)];
+
+		SendMidi(sequencer, message->port, message->status, message->d1, message->d2);
+		tail++;
+	}
+
+	thru->tail = tail;
+}
@@ -0,0 +1,106 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+//______________________________________________________________________________
+//
+// Headers
+//______________________________________________________________________________
+
+#include "app.h"
+#include "ramfunc.h"
+#include "sysex.h"
+#include "trace.h"
+
+//______________________________________________________________________________
+
+#ifdef __arm__
+#define DEMCR				(*(volatile u32 *)0xE000EDFC)
+#define DEMCR_TRCENA		(1 << 24)
+#define DWT_CTRL			(*(volatile u32 *)0xE0001000)
+#define DWT_CTRL_CYCCNTENA	(1 << 0)
+#endif
+
+void TraceInit()
+{
+#ifdef __arm__
+	DEMCR |= DEMCR_TRCENA;
+	DWT_CYCCNT = 0;
+	DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+#endif
+}
+
+RAMFUNC void TraceCheckOverrun(struct Trace *trace, u32 startCycles)
+{
+	u32 cycles = TraceCycles() - startCycles;
+
+	if (cycles > TRACE_OVERRUN_CYCLES)
+	{
+		if (cycles > 0xFFFFFF)
+		{
+			cycles = 0xFFFFFF;
+		}
+		TraceRecord(trace, TRACE_OVERRUN, cycles >> 16, cycles >> 8, cycles);
+	}
+}
+
+void TraceDump(struct Trace *trace, u8 port)
+{
+	// latch the head so events recorded while we're sending don't shift the window
+	u16 head = trace->head;
+	u16 count = trace->full ? TRACE_SIZE : head;
+	u16 first = head - count;
+	u8 chunks = (count + TRACE_CHUNK - 1) / TRACE_CHUNK;
+
+	struct TraceEvent events[TRACE_CHUNK];
+	u8 message[SYSEX_HEADER_SIZE + 3 + SYSEX_PACKED_SIZE(sizeof(events)) + 1];
+
+	for (u8 chunk = 0; chunk < chunks; chunk++)
+	{
+		u8 n = 0;
+		for (u16 i = chunk * TRACE_CHUNK; i < count && n < TRACE_CHUNK; i++)
+		{
+			events[n++] = trace->events[(first + i) & (TRACE_SIZE - 1)];
+		}
+
+		u16 length = 0;
+		message[length++] = SYSEX_START;
+		message[length++] = SYSEX_MANUFACTURER;
+		message[length++] = SYSEX_TRACE_CHUNK;
+		message[length++] = chunk;
+		message[length++] = chunks;
+		message[length++] = n;
+		length += SysexPack((const u8 *)events, n * sizeof(struct TraceEvent), &message[length]);
+		message[length++] = SYSEX_END;
+
+		hal_send_sysex(port, message, length);
+	}
+}
@@ -0,0 +1,297 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+#ifndef FIRMWARE_H
+#define FIRMWARE_H
+
+// Firmware images and the bootloader's SysEx format, shared by hextosyx and
+// syxverify.
+
+#include <stdint.h>
+#include <string.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static const int ByteWidth = 32;
+static const int ID = 0x0051;
+
+static const unsigned char RESET[] = {0xf0, 0x00, 0x20, 0x29, 0x00, 0x71};
+
+// seven bytes in, eight out
+static const int GroupIn = 7;
+static const int GroupOut = 8;
+
+// packed payload bytes actually sent per block
+static const int BlockOut = 1 + (ByteWidth * 8) / 7;
+
+// groups needed to cover a block - the last one reads past its end
+static const int BlockGroups = (ByteWidth + GroupIn - 1) / GroupIn;
+
+// ____________________________________________________________________________
+//
+// Flat firmware image
+// ____________________________________________________________________________
+
+struct Image
+{
+	unsigned long base; // lowest address with data
+	unsigned long max; // highest address with data
+	std::vector<unsigned char> bytes; // base..max, unset bytes are 0xff
+
+	Image() : base(~0UL), max(0) {}
+
+	unsigned char operator[](unsigned long addr) const
+	{
+		return addr - base < bytes.size() ? bytes[addr - base] : 0xff;
+	}
+};
+
+struct Chunk
+{
+	unsigned long addr;
+	std::vector<unsigned char> data;
+};
+
+inline void flatten(const std::vector<Chunk>& chunks, Image& image)
+{
+	for (size_t i = 0; i < chunks.size(); ++i)
+	{
+		if (chunks[i].data.empty())
+			continue;
+		if (chunks[i].addr < image.base)
+			image.base = chunks[i].addr;
+		if (chunks[i].addr + chunks[i].data.size() - 1 > image.max)
+			image.max = chunks[i].addr + chunks[i].data.size() - 1;
+	}
+	
+	if (image.base > image.max)
+		return;
+	
+	// pad past the end, so the last block's final group never reads outside the buffer
+	image.bytes.assign(image.max - image.base + 1 + ByteWidth + GroupIn, 0xff);
+	
+	for (size_t i = 0; i < chunks.size(); ++i)
+	{
+		if (!chunks[i].data.empty())
+			memcpy(&image.bytes[chunks[i].addr - image.base], &chunks[i].data[0], chunks[i].data.size());
+	}
+}
+
+inline uint32_t le(const unsigned char *p, int bytes)
+{
+	uint32_t value = 0;
+	while (bytes--)
+		value = (value << 8) | p[bytes];
+	return value;
+}
+
+// allocated sections of a little endian 32 bit ELF, at their load addresses.
+// The loadable segments give the load address, but they can also map the ELF
+// headers themselves, so only the bytes that belong to a section are taken -
+// the same as objcopy does.
+inline bool load_elf(const std::vector<unsigned char>& file, std::vector<Chunk>& chunks)
+{
+	if (file.size() < 52 || file[4] != 1 || file[5] != 1)
+	{
+		std::cerr << "only little endian 32 bit ELF files are supported" << std::endl;
+		return false;
+	}
+	
+	const uint32_t phoff = le(&file[28], 4);
+	const uint32_t shoff = le(&file[32], 4);
+	const uint32_t phentsize = le(&file[42], 2);
+	const uint32_t phnum = le(&file[44], 2);
+	const uint32_t shentsize = le(&file[46], 2);
+	const uint32_t shnum = le(&file[48], 2);
+	
+	if (phoff + phnum * phentsize > file.size() || shoff + shnum * shentsize > file.size())
+		return false;
+	
+	for (uint32_t i = 0; i < shnum; ++i)
+	{
+		const unsigned char *sh = &file[shoff + i * shentsize];
+		const uint32_t type = le(&sh[4], 4);
+		const uint32_t flags = le(&sh[8], 4);
+		const uint32_t offset = le(&sh[16], 4);
+		const uint32_t size = le(&sh[20], 4);
+		
+		// SHF_ALLOC, and not SHT_NOBITS like .bss
+		if (!(flags & 2) || type == 8 || size == 0 || offset + size > file.size())
+			continue;
+		
+		for (uint32_t j = 0; j < phnum; ++j)
+		{
+			const unsigned char *ph = &file[phoff + j * phentsize];
+			const uint32_t ptype = le(&ph[0], 4);
+			const uint32_t poffset = le(&ph[4], 4);
+			const uint32_t paddr = le(&ph[12], 4);
+			const uint32_t filesz = le(&ph[16], 4);
+			
+			// PT_LOAD containing this section
+			if (ptype != 1 || offset < poffset || offset + size > poffset + filesz)
+				continue;
+			
+			Chunk chunk;
+			chunk.addr = paddr + (offset - poffset);
+			chunk.data.assign(file.begin() + offset, file.begin() + offset + size);
+			chunks.push_back(chunk);
+			break;
+		}
+	}
+	
+	return true;
+}
+
+inline int hex_byte(const std::string& line, size_t pos)
+{
+	int value = 0;
+	for (size_t i = pos; i < pos + 2; ++i)
+	{
+		const char c = line[i];
+		value <<= 4;
+		if (c >= '0' && c <= '9')
+			value |= c - '0';
+		else if (c >= 'a' && c <= 'f')
+			value |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			value |= c - 'A' + 10;
+		else
+			return -1;
+	}
+	return value;
+}
+
+inline bool load_hex(const std::vector<unsigned char>& file, std::vector<Chunk>& chunks)
+{
+	std::istringstream in(std::string(file.begin(), file.end()));
+	std::string line;
+	unsigned long upper = 0;
+	
+	while (std::getline(in, line))
+	{
+		while (!line.empty() && (line[line.size() - 1] == '\r' || line[line.size() - 1] == ' '))
+			line.erase(line.size() - 1);
+		if (line.empty())
+			continue;
+		if (line[0] != ':' || line.size() < 11)
+			return false;
+		
+		const int count = hex_byte(line, 1);
+		const int addr = (hex_byte(line, 3) << 8) | hex_byte(line, 5);
+		const int type = hex_byte(line, 7);
+		if (count < 0 || addr < 0 || type < 0 || line.size() < 11 + (size_t)count * 2)
+			return false;
+		
+		std::vector<unsigned char> data(count);
+		for (int i = 0; i < count; ++i)
+			data[i] = hex_byte(line, 9 + i * 2);
+		
+		switch (type)
+		{
+			case 0x00: // data - append to the last chunk if it's contiguous
+				if (!chunks.empty() && chunks.back().addr + chunks.back().data.size() == upper + addr)
+				{
+					chunks.back().data.insert(chunks.back().data.end(), data.begin(), data.end());
+				}
+				else
+				{
+					Chunk chunk;
+					chunk.addr = upper + addr;
+					chunk.data = data;
+					chunks.push_back(chunk);
+				}
+				break;
+			case 0x01: // end of file
+				return true;
+			case 0x02: // extended segment address
+				upper = ((data[0] << 8) | data[1]) << 4;
+				break;
+			case 0x04: // extended linear address
+				upper = (unsigned long)((data[0] << 8) | data[1]) << 16;
+				break;
+		}
+	}
+	
+	return true;
+}
+
+inline bool load(const char *path, Image& image)
+{
+	std::ifstream ifs(path, std::ios::in | std::ios::binary);
+	if (!ifs)
+		return false;
+	
+	std::vector<unsigned char> file((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	std::vector<Chunk> chunks;
+	
+	const bool elf = file.size() >= 4 && !memcmp(&file[0], "\x7f" "ELF", 4);
+	if (!(elf ? load_elf(file, chunks) : load_hex(file, chunks)))
+		return false;
+	
+	flatten(chunks, image);
+	return !image.bytes.empty();
+}
+
+// ____________________________________________________________________________
+//
+// Packing
+// ____________________________________________________________________________
+
+// must match unpacking code in the bootloader, obviously
+//
+// seven bytes of eight-bit data are read as one 56 bit big endian word, and
+// cut into eight seven-bit bytes from the top down
+inline void eight_to_seven(unsigned char *out, const unsigned char *in)
+{
+	uint64_t word = 0;
+	for (int i = 0; i < GroupIn; ++i)
+		word = (word << 8) | in[i];
+	
+	for (int i = 0; i < GroupOut; ++i)
+		out[i] = (word >> (7 * (GroupOut - 1 - i))) & 0x7f;
+}
+
+// the reverse of eight_to_seven
+inline void seven_to_eight(unsigned char *out, const unsigned char *in)
+{
+	uint64_t word = 0;
+	for (int i = 0; i < GroupOut; ++i)
+		word = (word << 7) | (in[i] & 0x7f);
+	
+	for (int i = 0; i < GroupIn; ++i)
+		out[i] = word >> (8 * (GroupIn - 1 - i));
+}
+
+#endif
@@ -32,150 +32,106 @@
 
 // Ported from the original Delphi version.
 // CLI parameters for ID, ByteWidth and BaseAddress removed for simplicity
+//
+// Reads the firmware straight from the linker's ELF output (or from an Intel
+// HEX file, if you have one) into a flat image padded with 0xFF, packs it and
+// writes the whole .syx in a single write.
 
-#include <iostream>
-#include <fstream>
-#include "intelhex.h"
+#include "firmware.h"
 
-static const int ByteWidth = 32;
-static const int ID = 0x0051;
-
-static const unsigned char RESET[] = {0xf0, 0x00, 0x20, 0x29, 0x00, 0x71};
-
-// must match unpacking code in the bootloader, obviously
-static void eight_to_seven(unsigned char * Output, const int OOffset,
-			intelhex::hex_data& Input, const unsigned long IOffset)
-{
-	for (int i = 0; i < 7; ++i)
-	{
-		if (!Input.is_set(IOffset + i))
-		{
-			// pad unset addresses
-			Input.set(IOffset + i, 0xff);
-		}
-	}
-	
-	// seven bytes of eight-bit data converted to
-	// eight bytes of seven-bit data
-	// render 8-bit words as 16-bit words
-	Output[OOffset+0] =                           Input[IOffset+0] >> 1;
-	Output[OOffset+1] = (Input[IOffset+0] << 6) + (Input[IOffset+1] >> 2);
-	Output[OOffset+2] = (Input[IOffset+1] << 5) + (Input[IOffset+2] >> 3);
-	Output[OOffset+3] = (Input[IOffset+2] << 4) + (Input[IOffset+3] >> 4);
-	Output[OOffset+4] = (Input[IOffset+3] << 3) + (Input[IOffset+4] >> 5);
-	Output[OOffset+5] = (Input[IOffset+4] << 2) + (Input[IOffset+5] >> 6);
-	Output[OOffset+6] = (Input[IOffset+5] << 1) + (Input[IOffset+6] >> 7);
-	Output[OOffset+7] = (Input[IOffset+6]);
-
-	for (int i = 0; i < 8; ++i)
-	{
-		Output[OOffset+i] &= 0x7f;
-	}
-}
-
-static void write_block(intelhex::hex_data& data, std::ofstream& ofs, const unsigned long addr, const unsigned char type)
+static void write_block(const Image& image, std::vector<unsigned char>& out, const unsigned long addr, const unsigned char type)
 {
 	// packet header
-	ofs.write(reinterpret_cast<const char*>(RESET), 5);
-	ofs.put(type);
-	
-	int incount = 0;
-	int outcount = 0;
-	int outn = 1 + (ByteWidth * 8) / 7;
+	out.insert(out.end(), RESET, RESET + 5);
+	out.push_back(type);
 	
 	// payload
-	unsigned char payload[41];
+	unsigned char payload[BlockGroups * GroupOut];
+	const unsigned char *in = &image.bytes[addr - image.base];
 	
-	while (incount < ByteWidth)
-	{
-		eight_to_seven(payload, outcount, data, addr+incount);
-		
-		incount += 7;
-		outcount += 8;
-	}
+	for (int group = 0; group < BlockGroups; ++group)
+		eight_to_seven(&payload[group * GroupOut], &in[group * GroupIn]);
 	
-	ofs.write(reinterpret_cast<const char*>(payload), outn);
-	ofs.put(0xf7);
+	out.insert(out.end(), payload, payload + BlockOut);
+	out.push_back(0xf7);
 }
 
-static void write_header(intelhex::hex_data& data, std::ofstream& ofs, size_t BaseAddress)
+static void write_header(const Image& image, std::vector<unsigned char>& out)
 {
 	// human-readable version number & header block
-	ofs.write(reinterpret_cast<const char*>(RESET), 6);
-	ofs.put(ID >> 8);
-	ofs.put(ID & 0x7f);
-	
-	ofs.put(data[BaseAddress + 0x102] >> 4);
-	ofs.put(data[BaseAddress + 0x102] & 0x0f);
-	ofs.put(data[BaseAddress + 0x101] >> 4);
-	ofs.put(data[BaseAddress + 0x101] & 0x0f);
-	ofs.put(data[BaseAddress + 0x100] >> 4);
-	ofs.put(data[BaseAddress + 0x100] & 0x0f);
-	
-	ofs.put(0xf7);
+	out.insert(out.end(), RESET, RESET + 6);
+	out.push_back(ID >> 8);
+	out.push_back(ID & 0x7f);
+	
+	out.push_back(image[image.base + 0x102] >> 4);
+	out.push_back(image[image.base + 0x102] & 0x0f);
+	out.push_back(image[image.base + 0x101] >> 4);
+	out.push_back(image[image.base + 0x101] & 0x0f);
+	out.push_back(image[image.base + 0x100] >> 4);
+	out.push_back(image[image.base + 0x100] & 0x0f);
+	
+	out.push_back(0xf7);
 }
 
-static void write_checksum(intelhex::hex_data& data, std::ofstream& ofs)
+static void write_checksum(std::vector<unsigned char>& out)
 {
 	// device doesn't respect the checksum, but we still need this block!
-	ofs.write(reinterpret_cast<const char*>(RESET), 5);
-	unsigned char payload[19];
+	out.insert(out.end(), RESET, RESET + 5);
 	
 	const char *FIRMWARE = "Firmware";
 	
-	payload[0] = 0x76;
-	payload[1] = 0x00;
-	for (int i = 0; i < 8; ++i)
-	{
-		payload[i+2] = FIRMWARE[i];
-	}
-	payload[10] = 0x00;
-	payload[11] = 0x00;
-	payload[12] = 0x00;
-	payload[13] = 0x00;
-	payload[14] = 0x00;
-	payload[15] = 0x00;
-	payload[16] = 0x00;
-	payload[17] = 0x00;
-	payload[18] = 0xf7;
-	
-	ofs.write(reinterpret_cast<const char*>(payload), 19);
+	out.push_back(0x76);
+	out.push_back(0x00);
+	out.insert(out.end(), FIRMWARE, FIRMWARE + 8);
+	out.insert(out.end(), 8, 0x00);
+	out.push_back(0xf7);
 }
 
 int main(int argc, char *argv[])
 {
-	std::cout << "converting " << argv[1] << " to sysex file: " << argv[2] << std::endl;
+	if (argc < 3)
+	{
+		std::cerr << "usage: " << argv[0] << " <firmware.elf|firmware.hex> <firmware.syx>" << std::endl;
+		return -1;
+	}
 	
-	// read the hex file input
-	intelhex::hex_data data;
-	data.load(argv[1]);
+	std::cout << "converting " << argv[1] << " to sysex file: " << argv[2] << std::endl;
 	
-	size_t BaseAddress = data.min_address();
-	size_t MaxAddress = data.max_address();
+	// read the firmware image
+	Image image;
+	if (!load(argv[1], image))
+	{
+		std::cerr << "couldn't load " << argv[1] << std::endl;
+		return -1;
+	}
 	
-	std::cout << "max addr: " << std::hex << data.max_address() << " min_addr: " << std::hex << data.min_address() << std::endl;
+	std::cout << "max addr: " << std::hex << image.max << " min_addr: " << std::hex << image.base << std::endl;
 	
-	// create output file
-	std::ofstream ofs(argv[2] , std::ios::out | std::ios::binary);
-	if( !ofs )
-		return -1;
+	// build the whole file in memory...
+	std::vector<unsigned char> out;
+	out.reserve(((image.max - image.base) / ByteWidth + 4) * (BlockOut + 7));
 	
-	write_header(data, ofs, BaseAddress);
+	write_header(image, out);
 	
 	// payload blocks...
-	unsigned long i = BaseAddress + ByteWidth;
+	unsigned long i = image.base + ByteWidth;
 	
-	while (i < MaxAddress)
+	while (i < image.max)
 	{
-		write_block(data, ofs, i, 0x72);
+		write_block(image, out, i, 0x72);
 		
 		i += ByteWidth;
 	}
 	
-	write_block(data, ofs, BaseAddress, 0x73);
+	write_block(image, out, image.base, 0x73);
 	
 	// footer/checksum block
-	write_checksum(data, ofs);
+	write_checksum(out);
+	
+	// ...and write it in one go
+	std::ofstream ofs(argv[2], std::ios::out | std::ios::binary);
+	if (!ofs || !ofs.write(reinterpret_cast<const char*>(&out[0]), out.size()))
+		return -1;
 	
 	ofs.close();
 	
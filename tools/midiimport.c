@@ -0,0 +1,438 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+// Imports a Standard MIDI File into the sequencer's step grid and writes the
+// result as a SysEx state dump that can be sent straight to the unit (or fed
+// to render).  The file is parsed a byte at a time as it is read, so there's
+// no limit on its size.
+//
+// Up to NUMINSTRUMENTS tracks (or, with -c or for a format 0 file, channels)
+// are mapped to the instruments in the order their first notes appear.  Note-ons
+// are quantised to the nearest semiquaver step, and rows are counted up from
+// LOWESTNOTE.  Notes that fall outside the RANGE rows or past the end of the
+// PHRASES x STEPS grid are reported and dropped.
+//
+// usage: midiimport [-c] <in.mid> <out.syx>
+
+#include <stdio.h>
+#include <string.h>
+#include "app.h"
+#include "sequencer.h"
+#include "state.h"
+
+#define GRID_STEPS (STEPS * PHRASES)
+#define UNMAPPED 0xFF
+
+static struct Sequencer g_Sequencer;
+static FILE *g_Input = 0;
+static FILE *g_Output = 0;
+static long g_Remaining = 0; // bytes left in the current chunk
+
+// per track or channel - which instrument it feeds
+static u8 g_Map[256];
+static u8 g_Mapped = 0;
+
+static u32 g_OutOfRange[NUMINSTRUMENTS][128];
+static u32 g_PastEnd[NUMINSTRUMENTS];
+static u32 g_Steps[NUMINSTRUMENTS][GRID_STEPS * VOICEWORDS]; // stored once they're all in, so repeats share
+static u32 g_PoolFull[NUMINSTRUMENTS]; // phrases that didn't fit in the pool
+static u32 g_Imported[NUMINSTRUMENTS];
+static int g_LastPhrase = -1;
+
+// ____________________________________________________________________________
+//
+// HAL - the state dump goes to the output file, everything else is dropped
+// ____________________________________________________________________________
+
+void hal_plot_led(u8 type, u8 index, u8 red, u8 green, u8 blue)
+{
+}
+
+void hal_send_midi(u8 port, u8 status, u8 d1, u8 d2)
+{
+}
+
+void hal_send_sysex(u8 port, const u8* data, u16 length)
+{
+	fwrite(data, 1, length, g_Output);
+}
+
+void hal_read_flash(u32 offset, u8 *data, u32 length)
+{
+}
+
+void hal_write_flash(u32 offset,const u8 *data, u32 length)
+{
+}
+
+// ____________________________________________________________________________
+//
+// Streaming reads
+// ____________________________________________________________________________
+
+static int read_byte()
+{
+	if (g_Remaining-- <= 0)
+	{
+		return EOF;
+	}
+	return fgetc(g_Input);
+}
+
+// a data byte, or EOF if the track ends or has a status byte where one should be
+static int read_data()
+{
+	int c = read_byte();
+
+	return c == EOF || (c & 0x80) ? EOF : c;
+}
+
+static u32 read_be(int bytes)
+{
+	u32 value = 0;
+	while (bytes--)
+	{
+		value = (value << 8) | (fgetc(g_Input) & 0xFF);
+	}
+	return value;
+}
+
+static u32 read_varlen()
+{
+	u32 value = 0;
+	int c;
+
+	do
+	{
+		c = read_byte();
+		if (c == EOF)
+		{
+			return 0;
+		}
+		value = (value << 7) | (c & 0x7F);
+	} while (c & 0x80);
+
+	return value;
+}
+
+static void skip(u32 bytes)
+{
+	while (bytes-- && read_byte() != EOF)
+	{
+	}
+}
+
+// ____________________________________________________________________________
+
+static void add_note(u8 key, u8 note, u32 tick, u16 division)
+{
+	if (g_Map[key] == UNMAPPED)
+	{
+		if (g_Mapped == NUMINSTRUMENTS)
+		{
+			return;
+		}
+		g_Map[key] = g_Mapped++;
+	}
+
+	u8 instrument = g_Map[key];
+	u32 ticksPerStep = division / 4;
+	u32 step = (tick + (ticksPerStep / 2)) / ticksPerStep;
+
+	if (note < LOWESTNOTE || note >= LOWESTNOTE + RANGE)
+	{
+		if (note < 128)
+		{
+			g_OutOfRange[instrument][note]++;
+		}
+		return;
+	}
+	if (step >= GRID_STEPS)
+	{
+		g_PastEnd[instrument]++;
+		return;
+	}
+
+	g_Steps[instrument][(step * VOICEWORDS) + VOICEWORD(note - LOWESTNOTE)] |= VOICEBIT(note - LOWESTNOTE);
+	g_Imported[instrument]++;
+
+	if ((int)(step / STEPS) > g_LastPhrase)
+	{
+		g_LastPhrase = step / STEPS;
+	}
+}
+
+static void read_track(u8 track, u16 division, u8 byChannel, u8 *tempo)
+{
+	u32 tick = 0;
+	u8 status = 0;
+	int c;
+
+	while (g_Remaining > 0)
+	{
+		tick += read_varlen();
+
+		if ((c = read_byte()) == EOF)
+		{
+			break;
+		}
+
+		if (c == 0xFF)
+		{
+			u8 type = read_byte();
+			u32 length = read_varlen();
+
+			if (type == 0x51 && length == 3 && !*tempo)
+			{
+				u32 usPerQuarter = read_byte() << 16;
+				usPerQuarter |= read_byte() << 8;
+				usPerQuarter |= read_byte();
+				u32 bpm = (MS_PER_MIN * 1000UL + (usPerQuarter / 2)) / usPerQuarter;
+				*tempo = bpm < 1 ? 1 : bpm > 255 ? 255 : bpm;
+			}
+			else
+			{
+				skip(length);
+			}
+			continue;
+		}
+		if (c == 0xF0 || c == 0xF7)
+		{
+			skip(read_varlen());
+			continue;
+		}
+
+		// running status
+		int d1;
+		if (c & 0x80)
+		{
+			status = c;
+			d1 = read_data();
+		}
+		else
+		{
+			d1 = c;
+		}
+
+		// a truncated or corrupt event ends the track
+		int d2 = 0;
+		if (d1 == EOF)
+		{
+			break;
+		}
+
+		switch (status & 0xF0)
+		{
+			case NOTEON:
+			{
+				d2 = read_data();
+				if (d2 != EOF && d2 != 0)
+				{
+					add_note(byChannel ? (status & 0x0F) : track, d1, tick, division);
+				}
+			}
+			break;
+			case 0xC0: // program change
+			case CHANNELAFTERTOUCH:
+				break;
+			default:
+				d2 = read_data();
+				break;
+		}
+		if (d2 == EOF)
+		{
+			break;
+		}
+	}
+
+	skip(g_Remaining);
+}
+
+// different phrases with notes in, across every instrument - what the pool
+// has to hold for the dump to have them all
+static int count_phrases()
+{
+	static const u32 empty[STEPS * VOICEWORDS];
+	int phrases = g_LastPhrase + 1;
+	int count = 0;
+
+	for (int n = 0; n < NUMINSTRUMENTS * phrases; n++)
+	{
+		const u32 *steps = &g_Steps[n / phrases][(n % phrases) * STEPS * VOICEWORDS];
+		int seen = !memcmp(steps, empty, sizeof(empty));
+
+		for (int m = 0; m < n && !seen; m++)
+		{
+			seen = !memcmp(steps, &g_Steps[m / phrases][(m % phrases) * STEPS * VOICEWORDS], sizeof(empty));
+		}
+		count += !seen;
+	}
+	return count;
+}
+
+int main(int argc, char *argv[])
+{
+	int argi = 1;
+	u8 byChannel = 0;
+
+	if (argc > 1 && !strcmp(argv[1], "-c"))
+	{
+		byChannel = 1;
+		argi++;
+	}
+	if (argc - argi != 2)
+	{
+		fprintf(stderr, "usage: %s [-c] <in.mid> <out.syx>\n", argv[0]);
+		return -1;
+	}
+
+	g_Input = fopen(argv[argi], "rb");
+	if (!g_Input)
+	{
+		perror(argv[argi]);
+		return -1;
+	}
+
+	char id[4];
+	u32 headerLength;
+	if (fread(id, 1, 4, g_Input) != 4 || memcmp(id, "MThd", 4) || (headerLength = read_be(4)) < 6)
+	{
+		fprintf(stderr, "%s: not a Standard MIDI File\n", argv[argi]);
+		return -1;
+	}
+
+	u16 format = read_be(2);
+	u16 tracks = read_be(2);
+	u16 division = read_be(2);
+
+	// later versions of the format may add to the header
+	fseek(g_Input, headerLength - 6, SEEK_CUR);
+
+	if ((division & 0x8000) || division < 4)
+	{
+		fprintf(stderr, "%s: SMPTE time division isn't supported\n", argv[argi]);
+		return -1;
+	}
+	if (format == 0)
+	{
+		byChannel = 1;
+	}
+
+	memset(g_Map, UNMAPPED, sizeof(g_Map));
+	SequencerInit(&g_Sequencer);
+
+	u8 tempo = 0;
+	u16 track = 0;
+
+	while (track < tracks && fread(id, 1, 4, g_Input) == 4)
+	{
+		g_Remaining = read_be(4);
+
+		if (memcmp(id, "MTrk", 4))
+		{
+			// unknown chunk
+			skip(g_Remaining);
+			continue;
+		}
+
+		read_track(track++ & 0xFF, division, byChannel, &tempo);
+	}
+
+	fclose(g_Input);
+
+	// phrases are shared between instruments, in a pool that holds fewer than
+	// every instrument's full sequence - say so before writing a dump without some
+	int phrases = count_phrases();
+	if (phrases > POOLSIZE - 1)
+	{
+		fprintf(stderr, "warning: %d different phrases, but the pool holds %d - the rest will be left empty\n", phrases, POOLSIZE - 1);
+	}
+
+	// play every phrase up to the last one with notes in, on every instrument
+	for (u8 i = 0; i < NUMINSTRUMENTS; i++)
+	{
+		for (int phrase = 0; phrase <= g_LastPhrase; phrase++)
+		{
+			if (!PhraseStore(&g_Sequencer, &g_Sequencer.instruments[i], phrase, &g_Steps[i][phrase * STEPS * VOICEWORDS]))
+			{
+				g_PoolFull[i]++;
+			}
+			g_Sequencer.arrangement->sequence[i][phrase] = phrase + 1;
+		}
+		SetSequenceLength(g_Sequencer.arrangement, i, g_LastPhrase + 1);
+	}
+	if (tempo)
+	{
+		CalculateMsPerClock(&g_Sequencer, tempo);
+	}
+
+	g_Output = fopen(argv[argi + 1], "wb");
+	if (!g_Output)
+	{
+		perror(argv[argi + 1]);
+		return -1;
+	}
+	StateDump(&g_Sequencer, USBSTANDALONE);
+	fclose(g_Output);
+
+	// report
+	printf("%d phrases at %d bpm\n", g_LastPhrase + 1, g_Sequencer.arrangement->tempo);
+
+	for (u16 key = 0; key < 256; key++)
+	{
+		if (g_Map[key] == UNMAPPED)
+		{
+			continue;
+		}
+
+		u8 i = g_Map[key];
+		printf("%s %d -> instrument %d: %lu notes\n", byChannel ? "channel" : "track", byChannel ? key + 1 : key, i, (unsigned long)g_Imported[i]);
+
+		for (int note = 0; note < 128; note++)
+		{
+			if (g_OutOfRange[i][note])
+			{
+				printf("  note %d is outside %d-%d: %lu dropped\n", note, LOWESTNOTE, LOWESTNOTE + RANGE - 1, (unsigned long)g_OutOfRange[i][note]);
+			}
+		}
+		if (g_PastEnd[i])
+		{
+			printf("  past the end of the last phrase: %lu dropped\n", (unsigned long)g_PastEnd[i]);
+		}
+		if (g_PoolFull[i])
+		{
+			printf("  more different phrases than the pool holds: %lu left empty\n", (unsigned long)g_PoolFull[i]);
+		}
+	}
+
+	return 0;
+}
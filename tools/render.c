@@ -0,0 +1,498 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+// Renders the sequencer to a Standard MIDI File, faster than real time.  The
+// engine runs against a virtual millisecond clock, and every message it sends
+// to the chosen port is written out with its exact delta time.  One file tick
+// is one millisecond, so the timing is sample-exact however the tempo was
+// rounded to whole milliseconds per clock.
+//
+// usage: render [options] [state.syx]
+//
+//   state.syx      a state dump to load before rendering (see state.h)
+//   -s script      apply scripted edits after loading - one per line:
+//                    press <index> / release <index> / tap <index>
+//                  where <index> is a pad or button index as in app.h, or
+//                    wait <steps>
+//                  to render that many steps before going on
+//   -b bars        render this many bars of 16 steps, rather than rendering
+//                  until the arrangement loops
+//   -p port        port to capture: 0 standalone, 1 usb, 2 din (default 2)
+//   -n             leave out clock, start and stop
+//   -l             list the events on stdout as well, one per line - the
+//                  time in ms and the message in hex - for comparing runs
+//   -o file.mid    output file (default render.mid)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "app.h"
+#include "sequencer.h"
+#include "state.h"
+#include "sysex.h"
+
+#define MAX_LOOP_BARS 1024
+
+static struct Sequencer g_Sequencer;
+
+static FILE *g_File = 0;
+static FILE *g_Script = 0;
+static const char *g_ScriptPath = 0;
+static int g_ScriptLine = 0;
+static u32 g_Now = 0; // virtual time in ms
+static u32 g_LastEvent = 0; // time of the last event written
+static u32 g_Events = 0;
+static u8 g_Recording = 0;
+static u8 g_Port = DINMIDI;
+static u8 g_Clock = 1;
+static u8 g_List = 0;
+static u8 g_Sounding[16][128];
+static u32 g_Refused[SYSEX_REFUSED_FULL + 1]; // state messages refused while loading, by reason
+
+// ____________________________________________________________________________
+//
+// SMF writing
+// ____________________________________________________________________________
+
+static void write_varlen(u32 value)
+{
+	u8 bytes[5];
+	int n = 0;
+
+	do
+	{
+		bytes[n++] = value & 0x7F;
+		value >>= 7;
+	} while (value);
+
+	while (n--)
+	{
+		fputc(bytes[n] | (n ? 0x80 : 0), g_File);
+	}
+}
+
+static void write_be(u32 value, int bytes)
+{
+	while (bytes--)
+	{
+		fputc((value >> (bytes * 8)) & 0xFF, g_File);
+	}
+}
+
+static void write_event(u32 time, const u8 *data, int length)
+{
+	// meta events are the file's, not the sequencer's
+	if (g_List && data[0] != 0xFF)
+	{
+		int escaped = data[0] == 0xF7 ? 2 : 0;
+
+		printf("%lu", (unsigned long)time);
+		for (int i = escaped; i < length; i++)
+		{
+			printf(" %02X", data[i]);
+		}
+		printf("\n");
+	}
+
+	write_varlen(time - g_LastEvent);
+	fwrite(data, 1, length, g_File);
+	g_LastEvent = time;
+	g_Events++;
+}
+
+static void write_escaped(u32 time, const u8 *data, int length)
+{
+	// system messages can't appear in a track directly - escape them
+	u8 escaped[8] = {0xF7, length};
+	memcpy(&escaped[2], data, length);
+	write_event(time, escaped, length + 2);
+}
+
+static long write_header(u16 division)
+{
+	fwrite("MThd", 1, 4, g_File);
+	write_be(6, 4);
+	write_be(0, 2); // format 0
+	write_be(1, 2); // one track
+	write_be(division, 2);
+
+	fwrite("MTrk", 1, 4, g_File);
+	long lengthOffset = ftell(g_File);
+	write_be(0, 4); // patched by write_footer
+
+	// the tempo that makes one tick one millisecond
+	u32 usPerQuarter = division * 1000;
+	u8 tempo[] = {0xFF, 0x51, 0x03, usPerQuarter >> 16, usPerQuarter >> 8, usPerQuarter};
+	write_event(0, tempo, sizeof(tempo));
+
+	return lengthOffset;
+}
+
+static void write_footer(u32 time, long lengthOffset)
+{
+	u8 end[] = {0xFF, 0x2F, 0x00};
+	write_event(time, end, sizeof(end));
+
+	long trackEnd = ftell(g_File);
+	fseek(g_File, lengthOffset, SEEK_SET);
+	write_be(trackEnd - lengthOffset - 4, 4);
+	fseek(g_File, trackEnd, SEEK_SET);
+}
+
+// ____________________________________________________________________________
+//
+// HAL - MIDI goes to the file, everything else is dropped
+// ____________________________________________________________________________
+
+void hal_plot_led(u8 type, u8 index, u8 red, u8 green, u8 blue)
+{
+}
+
+void hal_send_midi(u8 port, u8 status, u8 d1, u8 d2)
+{
+	if (!g_Recording || port != g_Port)
+	{
+		return;
+	}
+
+	u8 data[3] = {status, d1, d2};
+
+	if (status >= 0xF0)
+	{
+		if (g_Clock)
+		{
+			write_escaped(g_Now, data, status == SONGPOSITIONPOINTER ? 3 : 1);
+		}
+		return;
+	}
+
+	switch (status & 0xF0)
+	{
+		case NOTEON:
+			g_Sounding[status & 0x0F][d1] = d2 != 0;
+			break;
+		case NOTEOFF:
+			g_Sounding[status & 0x0F][d1] = 0;
+			break;
+	}
+
+	// program change and channel pressure have a single data byte
+	int length = ((status & 0xE0) == 0xC0) ? 2 : 3;
+	write_event(g_Now, data, length);
+}
+
+void hal_send_sysex(u8 port, const u8* data, u16 length)
+{
+	if (length > SYSEX_HEADER_SIZE && data[2] == SYSEX_STATE_REFUSED && data[SYSEX_HEADER_SIZE] <= SYSEX_REFUSED_FULL)
+	{
+		g_Refused[data[SYSEX_HEADER_SIZE]]++;
+	}
+}
+
+void hal_read_flash(u32 offset, u8 *data, u32 length)
+{
+}
+
+void hal_write_flash(u32 offset,const u8 *data, u32 length)
+{
+}
+
+// ____________________________________________________________________________
+//
+// Loading
+// ____________________________________________________________________________
+
+static int load_state(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f)
+	{
+		perror(path);
+		return 0;
+	}
+
+	u8 message[320];
+	u16 length = 0;
+	int c;
+
+	while ((c = fgetc(f)) != EOF)
+	{
+		if (c == 0xF0)
+		{
+			length = 0;
+		}
+		if (length < sizeof(message))
+		{
+			message[length++] = c;
+		}
+		if (c == 0xF7)
+		{
+			SequencerSysex(&g_Sequencer, USBSTANDALONE, message, length);
+
+			// there's no timer running yet to load it, and a dump is longer than the queue
+			StateFlush(&g_Sequencer);
+		}
+	}
+
+	fclose(f);
+
+	// a device would refuse the same messages, so say what it'd be missing
+	if (g_Refused[SYSEX_REFUSED_FULL])
+	{
+		fprintf(stderr, "warning: %s: %lu phrases didn't fit in the pool of %d and were left empty\n", path, (unsigned long)g_Refused[SYSEX_REFUSED_FULL], POOLSIZE - 1);
+	}
+	if (g_Refused[SYSEX_REFUSED_INVALID])
+	{
+		fprintf(stderr, "warning: %s: %lu messages weren't state messages this version understands\n", path, (unsigned long)g_Refused[SYSEX_REFUSED_INVALID]);
+	}
+	return 1;
+}
+
+// run the script up to the next wait, and return how many steps it waits for,
+// or 0 at the end
+static u32 run_script()
+{
+	char line[128];
+	char command[16];
+	int index;
+
+	while (g_Script && fgets(line, sizeof(line), g_Script))
+	{
+		g_ScriptLine++;
+		if (line[0] == '#' || sscanf(line, "%15s", command) != 1)
+		{
+			continue;
+		}
+		if (sscanf(line, "%15s %d", command, &index) == 2 && !strcmp(command, "wait") && index > 0)
+		{
+			return index;
+		}
+		if (sscanf(line, "%15s %d", command, &index) != 2 || index < 0 || index > 99)
+		{
+			fprintf(stderr, "%s:%d: expected <command> <index>\n", g_ScriptPath, g_ScriptLine);
+			continue;
+		}
+
+		if (!strcmp(command, "press") || !strcmp(command, "tap"))
+		{
+			SequencerSurface(&g_Sequencer, TYPEPAD, index, 127);
+		}
+		if (!strcmp(command, "release") || !strcmp(command, "tap"))
+		{
+			SequencerSurface(&g_Sequencer, TYPEPAD, index, 0);
+		}
+
+		// there may be no timer running yet to apply the edits, and a long script could fill the queue
+		CommandsApply(&g_Sequencer);
+	}
+
+	if (g_Script)
+	{
+		fclose(g_Script);
+		g_Script = 0;
+	}
+	return 0;
+}
+
+// ____________________________________________________________________________
+
+static u32 gcd(u32 a, u32 b)
+{
+	while (b)
+	{
+		u32 t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// steps until every instrument is back at the start of its arrangement
+static u32 loop_steps()
+{
+	u32 phrases = 1;
+
+	for (int i = 0; i < NUMINSTRUMENTS; i++)
+	{
+		u32 length = g_Sequencer.arrangement->length[i];
+
+		if (length)
+		{
+			phrases = phrases / gcd(phrases, length) * length;
+		}
+		if (phrases * STEPS > MAX_LOOP_BARS * BAR_STEPS)
+		{
+			return MAX_LOOP_BARS * BAR_STEPS;
+		}
+	}
+
+	return phrases * STEPS;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *output = "render.mid";
+	const char *script = 0;
+	const char *state = 0;
+	u32 bars = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-o") && i + 1 < argc)
+		{
+			output = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+		{
+			script = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+		{
+			bars = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+		{
+			g_Port = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-n"))
+		{
+			g_Clock = 0;
+		}
+		else if (!strcmp(argv[i], "-l"))
+		{
+			g_List = 1;
+		}
+		else if (argv[i][0] != '-')
+		{
+			state = argv[i];
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [-s script] [-b bars] [-p port] [-n] [-l] [-o file.mid] [state.syx]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	g_File = fopen(output, "wb");
+	if (!g_File)
+	{
+		perror(output);
+		return -1;
+	}
+
+	clock_t started = clock();
+
+	// the header needs the final tempo, so set everything up before writing it
+	SequencerInit(&g_Sequencer);
+
+	if (script)
+	{
+		g_Script = fopen(script, "r");
+		g_ScriptPath = script;
+		if (!g_Script)
+		{
+			perror(script);
+			return -1;
+		}
+	}
+	if (state && !load_state(state))
+	{
+		return -1;
+	}
+	u32 wait = run_script();
+
+	long lengthOffset = write_header(CLOCK_RATE * g_Sequencer.msPerTick);
+
+	// the engine sent MIDI start from SequencerInit, before we were recording
+	g_Recording = 1;
+	if (g_Clock)
+	{
+		u8 start = MIDISTART;
+		write_escaped(0, &start, 1);
+	}
+
+	u32 target = bars ? bars * BAR_STEPS : loop_steps();
+	u32 steps = 0;
+
+	while (steps < target)
+	{
+		g_Now++;
+		SequencerTimer(&g_Sequencer);
+
+		if (g_Sequencer.lastClock == g_Sequencer.now && g_Sequencer.semiquaverInterval == 0)
+		{
+			steps++;
+
+			// the rest of the script happens part way through
+			if (wait && !--wait)
+			{
+				wait = run_script();
+			}
+		}
+	}
+
+	// the song ends where the next step would have started
+	g_Now += g_Sequencer.msPerTick * 6;
+
+	for (int channel = 0; channel < 16; channel++)
+	{
+		for (int note = 0; note < 128; note++)
+		{
+			if (g_Sounding[channel][note])
+			{
+				u8 off[3] = {NOTEOFF | channel, note, 0};
+				write_event(g_Now, off, 3);
+			}
+		}
+	}
+
+	if (g_Clock)
+	{
+		u8 stop = MIDISTOP;
+		write_escaped(g_Now, &stop, 1);
+	}
+
+	write_footer(g_Now, lengthOffset);
+	fclose(g_File);
+
+	if (g_List)
+	{
+		return 0;
+	}
+
+	printf("rendered %lu steps (%lu ms of music, %lu events) to %s in %.1f ms\n",
+		(unsigned long)steps, (unsigned long)g_Now, (unsigned long)g_Events, output,
+		1000.0 * (clock() - started) / CLOCKS_PER_SEC);
+
+	return 0;
+}
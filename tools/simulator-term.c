@@ -0,0 +1,411 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+// Interactive simulator for Linux terminals.  It keeps an RGB model of the
+// 10x10 button layout described in app.h, and repaints it in true colour at
+// up to FRAME_RATE frames a second, only emitting escape sequences for the
+// cells that changed since the last frame.  The app's timer runs at the real
+// 1kHz rate, and the keyboard drives the surface:
+//
+//   arrows / hjkl  move the cursor around the grid
+//   space          tap the pad under the cursor
+//   enter          hold the pad under the cursor, or release it if held
+//   tab            hold or release the Setup button
+//   a n s          arranger / note / scene screen
+//   1 2 3 4        channels in the current bank
+//   b              next bank
+//   c              next scale
+//   - =            tempo down / up
+//   , .            release down / up
+//   [ ] ; '        page left / right / down / up
+//   x              remove phrase
+//   p o            play / stop
+//   u r            undo / redo
+//   A M O          hold or release append phrase / mute channel / stop
+//   ctrl-c         quit
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include "app.h"
+#include "sequencer.h"
+
+#define GRID 10
+#define CELLS (GRID * GRID)
+#define FRAME_RATE 30
+#define SETUP_CELL 0 // the Setup LED is drawn in the (unused) bottom left corner
+
+struct Cell
+{
+	u8 rgb[3];
+	u8 label; // index into LABELS
+};
+
+static const char *LABELS[] = {"  ", "[]", "<>"};
+
+static struct Cell g_Model[CELLS]; // what the app has plotted
+static struct Cell g_Shown[CELLS]; // what's on the terminal
+static u8 g_Dirty[CELLS];
+static u8 g_Held[CELLS];
+static u8 g_SetupHeld = 0;
+static u8 g_Cursor = 11;
+
+static char g_Status[80];
+static u8 g_StatusDirty = 1;
+
+static struct termios g_SavedTermios;
+
+// ____________________________________________________________________________
+//
+// Key bindings
+// ____________________________________________________________________________
+
+struct Key
+{
+	char key;
+	u8 index;
+	u8 hold; // latch rather than tap
+};
+
+static const struct Key KEYS[] =
+{
+	{'a', ARRANGERSCREEN, 0},
+	{'n', NOTESCREEN, 0},
+	{'s', SCENESCREEN, 0},
+	{'1', CHANNEL0, 0},
+	{'2', CHANNEL1, 0},
+	{'3', CHANNEL2, 0},
+	{'4', CHANNEL3, 0},
+	{'b', BANK, 0},
+	{'c', NEXTSCALE, 0},
+	{'-', TEMPODOWN, 0},
+	{'=', TEMPOUP, 0},
+	{',', RELEASEDOWN, 0},
+	{'.', RELEASEUP, 0},
+	{'[', PAGELEFT, 0},
+	{']', PAGERIGHT, 0},
+	{';', PAGEDOWN, 0},
+	{'\'', PAGEUP, 0},
+	{'x', REMOVEPHRASE, 0},
+	{'p', PLAYSONG, 0},
+	{'o', STOPSONG, 0},
+	{'u', UNDO, 0},
+	{'r', REDO, 0},
+	{'A', APPENDPHRASE, 1},
+	{'M', MUTECHANNEL, 1},
+	{'O', STOPSONG, 1},
+};
+
+// ____________________________________________________________________________
+//
+// Simulator "hal"
+// ____________________________________________________________________________
+
+static void plot(u8 cell, u8 red, u8 green, u8 blue)
+{
+	struct Cell *c = &g_Model[cell];
+
+	c->rgb[0] = red;
+	c->rgb[1] = green;
+	c->rgb[2] = blue;
+	g_Dirty[cell] = 1;
+}
+
+void hal_plot_led(u8 type, u8 index, u8 red, u8 green, u8 blue)
+{
+	if (type == TYPESETUP)
+	{
+		plot(SETUP_CELL, red, green, blue);
+	}
+	else if (index < CELLS)
+	{
+		plot(index, red, green, blue);
+	}
+}
+
+void hal_send_midi(u8 port, u8 status, u8 d1, u8 d2)
+{
+	if (status == MIDITIMINGCLOCK)
+	{
+		return;
+	}
+	snprintf(g_Status, sizeof(g_Status), "midi out port %d: %02x %02x %02x", port, status, d1, d2);
+	g_StatusDirty = 1;
+}
+
+void hal_send_sysex(u8 port, const u8* data, u16 length)
+{
+}
+
+void hal_read_flash(u32 offset, u8 *data, u32 length)
+{
+	// a fresh device reads back 0xFF
+	memset(data, 0xFF, length);
+}
+
+void hal_write_flash(u32 offset,const u8 *data, u32 length)
+{
+}
+
+// ____________________________________________________________________________
+//
+// Terminal
+// ____________________________________________________________________________
+
+static void restore_terminal()
+{
+	tcsetattr(STDIN_FILENO, TCSANOW, &g_SavedTermios);
+	printf("\033[0m\033[?25h\033[%d;1H\n", GRID + 3);
+	fflush(stdout);
+}
+
+// set from the signal handler, which can't safely do anything more - the
+// main loop sees it within a tick and returns, restoring the terminal
+static volatile sig_atomic_t g_Quit = 0;
+
+static void on_signal(int signal)
+{
+	g_Quit = 1;
+}
+
+static void setup_terminal()
+{
+	struct termios raw;
+
+	tcgetattr(STDIN_FILENO, &g_SavedTermios);
+	atexit(restore_terminal);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	raw = g_SavedTermios;
+	raw.c_lflag &= ~(ICANON | ECHO);
+	raw.c_cc[VMIN] = 0;
+	raw.c_cc[VTIME] = 0;
+	tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+	// clear, hide the cursor, and force the first frame to draw everything
+	printf("\033[2J\033[?25l");
+	memset(g_Dirty, 1, sizeof(g_Dirty));
+	memset(g_Shown, 0xFF, sizeof(g_Shown));
+	g_Dirty[g_Cursor] = 1;
+}
+
+static int cell_exists(u8 cell)
+{
+	// the corners aren't real buttons (but the bottom left shows Setup)
+	return cell != 9 && cell != 90 && cell != 99;
+}
+
+static void render()
+{
+	static char frame[CELLS * 48 + 128];
+	int length = 0;
+	int lastCell = -1;
+
+	for (u8 cell = 0; cell < CELLS; cell++)
+	{
+		if (!g_Dirty[cell])
+		{
+			continue;
+		}
+		g_Dirty[cell] = 0;
+
+		g_Model[cell].label = cell == g_Cursor ? 1 : g_Held[cell] ? 2 : 0;
+		if (!memcmp(&g_Shown[cell], &g_Model[cell], sizeof(struct Cell)))
+		{
+			continue;
+		}
+		g_Shown[cell] = g_Model[cell];
+
+		// only move the cursor if we're not already there
+		if (lastCell != cell - 1 || cell % GRID == 0)
+		{
+			length += sprintf(&frame[length], "\033[%d;%dH", GRID - (cell / GRID), 1 + (cell % GRID) * 3);
+		}
+		lastCell = cell;
+
+		if (!cell_exists(cell))
+		{
+			length += sprintf(&frame[length], "\033[0m   ");
+			continue;
+		}
+
+		const u8 *rgb = g_Model[cell].rgb;
+
+		length += sprintf(&frame[length], "\033[48;2;%d;%d;%dm\033[38;2;255;255;255m%s\033[0m ",
+			rgb[0] * 255 / MAXLED, rgb[1] * 255 / MAXLED, rgb[2] * 255 / MAXLED, LABELS[g_Model[cell].label]);
+	}
+
+	if (g_StatusDirty)
+	{
+		g_StatusDirty = 0;
+		length += sprintf(&frame[length], "\033[%d;1H\033[0m\033[K%s", GRID + 2, g_Status);
+	}
+
+	if (length)
+	{
+		fwrite(frame, 1, length, stdout);
+		fflush(stdout);
+	}
+}
+
+// ____________________________________________________________________________
+//
+// Input
+// ____________________________________________________________________________
+
+static void move_cursor(int dx, int dy)
+{
+	int x = (g_Cursor % GRID) + dx;
+	int y = (g_Cursor / GRID) + dy;
+
+	if (x < 0 || x >= GRID || y < 0 || y >= GRID || !cell_exists(y * GRID + x) || y * GRID + x == 0)
+	{
+		return;
+	}
+
+	g_Dirty[g_Cursor] = 1;
+	g_Cursor = y * GRID + x;
+	g_Dirty[g_Cursor] = 1;
+}
+
+static void tap(u8 index)
+{
+	app_surface_event(TYPEPAD, index, 127);
+	app_surface_event(TYPEPAD, index, 0);
+}
+
+static void toggle_hold(u8 index)
+{
+	g_Held[index] ^= 1;
+	g_Dirty[index] = 1;
+	app_surface_event(TYPEPAD, index, g_Held[index] ? 127 : 0);
+}
+
+static void poll_keyboard()
+{
+	char keys[16];
+	int count = read(STDIN_FILENO, keys, sizeof(keys));
+
+	for (int i = 0; i < count; i++)
+	{
+		char key = keys[i];
+
+		// arrow keys arrive as ESC [ A..D
+		if (key == '\033' && i + 2 < count && keys[i + 1] == '[')
+		{
+			switch (keys[i + 2])
+			{
+				case 'A': key = 'k'; break;
+				case 'B': key = 'j'; break;
+				case 'C': key = 'l'; break;
+				case 'D': key = 'h'; break;
+			}
+			i += 2;
+		}
+
+		switch (key)
+		{
+			case 'h': move_cursor(-1, 0); continue;
+			case 'l': move_cursor(1, 0); continue;
+			case 'k': move_cursor(0, 1); continue;
+			case 'j': move_cursor(0, -1); continue;
+			case ' ': tap(g_Cursor); continue;
+			case '\n': toggle_hold(g_Cursor); continue;
+			case '\t':
+			{
+				g_SetupHeld ^= 1;
+				app_surface_event(TYPESETUP, 0, g_SetupHeld ? 127 : 0);
+			}
+			continue;
+		}
+
+		for (u8 k = 0; k < sizeof(KEYS) / sizeof(KEYS[0]); k++)
+		{
+			if (KEYS[k].key == key)
+			{
+				if (KEYS[k].hold)
+				{
+					toggle_hold(KEYS[k].index);
+				}
+				else
+				{
+					tap(KEYS[k].index);
+				}
+			}
+		}
+	}
+}
+
+// ____________________________________________________________________________
+
+static u16 raw_ADC[64];
+
+int main(int argc, char * argv[])
+{
+	setup_terminal();
+	app_init(raw_ADC);
+
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	u32 ms = 0;
+
+	while (!g_Quit)
+	{
+		// 1kHz tick against an absolute deadline, so lateness doesn't accumulate
+		next.tv_nsec += 1000000;
+		if (next.tv_nsec >= 1000000000)
+		{
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, 0);
+
+		poll_keyboard();
+		app_timer_event();
+
+		if (++ms >= 1000 / FRAME_RATE)
+		{
+			ms = 0;
+			render();
+		}
+	}
+
+	return 0;
+}
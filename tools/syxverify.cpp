@@ -0,0 +1,289 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+// Checks a .syx firmware file: parses the header, the 0x72/0x73 data blocks
+// and the footer, unpacks the blocks back into a flat binary at the base
+// address, and reports a CRC32 of it.  Given the ELF or hex file the .syx was
+// made from, it also compares the two byte for byte and fails on any
+// difference, so it can gate a release.
+//
+// usage: syxverify <firmware.syx> [firmware.elf|firmware.hex] [-o image.bin] [-b base]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "firmware.h"
+
+// where the linker script puts the app, used when there's nothing to compare against
+static const unsigned long DefaultBase = 0x08006400;
+
+static const int MaxReported = 16;
+
+static uint32_t crc32(const unsigned char *data, size_t length)
+{
+	static uint32_t table[256];
+	if (!table[1])
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k)
+				c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	}
+	
+	uint32_t crc = 0xffffffff;
+	for (size_t i = 0; i < length; ++i)
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return crc ^ 0xffffffff;
+}
+
+static bool is_message(const unsigned char *m, size_t length, size_t expected, unsigned char type)
+{
+	return length == expected && !memcmp(m, RESET, 5) && m[5] == type;
+}
+
+static void unpack_block(const unsigned char *packed, unsigned char *out)
+{
+	// the last group is cut short on the wire - fill it back out with zeros
+	unsigned char groups[BlockGroups * GroupOut] = {0};
+	unsigned char bytes[BlockGroups * GroupIn];
+	
+	memcpy(groups, packed, BlockOut);
+	for (int group = 0; group < BlockGroups; ++group)
+		seven_to_eight(&bytes[group * GroupIn], &groups[group * GroupOut]);
+	
+	memcpy(out, bytes, ByteWidth);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *syxPath = 0;
+	const char *refPath = 0;
+	const char *outPath = 0;
+	unsigned long base = DefaultBase;
+	bool baseGiven = false;
+	
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-o") && i + 1 < argc)
+			outPath = argv[++i];
+		else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+		{
+			base = strtoul(argv[++i], 0, 0);
+			baseGiven = true;
+		}
+		else if (!syxPath)
+			syxPath = argv[i];
+		else if (!refPath)
+			refPath = argv[i];
+	}
+	
+	if (!syxPath)
+	{
+		std::cerr << "usage: " << argv[0] << " <firmware.syx> [firmware.elf|firmware.hex] [-o image.bin] [-b base]" << std::endl;
+		return -1;
+	}
+	
+	std::ifstream ifs(syxPath, std::ios::in | std::ios::binary);
+	if (!ifs)
+	{
+		std::cerr << "couldn't open " << syxPath << std::endl;
+		return -1;
+	}
+	std::vector<unsigned char> syx((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	
+	Image reference;
+	if (refPath)
+	{
+		if (!load(refPath, reference))
+		{
+			std::cerr << "couldn't load " << refPath << std::endl;
+			return -1;
+		}
+		if (!baseGiven)
+			base = reference.base;
+	}
+	
+	// walk the messages - header, 0x72 blocks from base + ByteWidth upwards,
+	// the 0x73 block for base itself, then the footer
+	const size_t HeaderLength = 6 + 2 + 6 + 1;
+	const size_t BlockLength = 5 + 1 + BlockOut + 1;
+	const size_t FooterLength = 5 + 2 + 8 + 8 + 1;
+	
+	std::vector<unsigned char> image(ByteWidth, 0xff);
+	unsigned char version[6] = {0};
+	int errors = 0;
+	bool header = false, first = false, footer = false;
+	size_t blocks = 0;
+	
+	for (size_t pos = 0; pos < syx.size(); )
+	{
+		size_t end = pos;
+		while (end < syx.size() && syx[end] != 0xf7)
+			++end;
+		if (end == syx.size() || syx[pos] != 0xf0)
+		{
+			std::cerr << "malformed message at offset " << pos << std::endl;
+			return 1;
+		}
+		
+		const unsigned char *m = &syx[pos];
+		const size_t length = end - pos + 1;
+		
+		if (!header)
+		{
+			if (length != HeaderLength || memcmp(m, RESET, 6) || m[6] != (ID >> 8) || m[7] != (ID & 0x7f))
+			{
+				std::cerr << "missing or bad header" << std::endl;
+				return 1;
+			}
+			memcpy(version, &m[8], 6);
+			header = true;
+		}
+		else if (footer)
+		{
+			std::cerr << "data after the footer at offset " << pos << std::endl;
+			++errors;
+		}
+		else if (is_message(m, length, BlockLength, 0x72) && !first)
+		{
+			image.resize(image.size() + ByteWidth);
+			unpack_block(&m[6], &image[image.size() - ByteWidth]);
+			++blocks;
+		}
+		else if (is_message(m, length, BlockLength, 0x73) && !first)
+		{
+			unpack_block(&m[6], &image[0]);
+			first = true;
+			++blocks;
+		}
+		else if (is_message(m, length, FooterLength, 0x76) && first && !memcmp(&m[7], "Firmware", 8))
+		{
+			footer = true;
+		}
+		else
+		{
+			std::cerr << "unexpected message at offset " << pos << std::endl;
+			++errors;
+		}
+		
+		pos = end + 1;
+	}
+	
+	if (!first || !footer)
+	{
+		std::cerr << (first ? "missing footer" : "missing 0x73 block") << std::endl;
+		++errors;
+	}
+	
+	// hextosyx puts the version bytes at 0x100..0x102 in the header as nibbles.
+	// Other tools (like the one that made the factory image) don't, so without
+	// a reference a difference is only a warning.
+	for (int i = 0; i < 3; ++i)
+	{
+		const unsigned long addr = 0x102 - i;
+		const unsigned char fromHeader = (version[i * 2] << 4) | version[i * 2 + 1];
+		const unsigned char expected = refPath ? reference[base + addr] : (image.size() > addr ? image[addr] : 0xff);
+		
+		if (fromHeader != expected)
+		{
+			std::cerr << (refPath ? "" : "warning: ") << "header version byte 0x" << std::hex << addr << " is " << (int)fromHeader << ", expected " << (int)expected << std::endl;
+			errors += refPath ? 1 : 0;
+		}
+	}
+	
+	// compare the range the reference covers, or everything up to the last non-0xff byte
+	size_t length = image.size();
+	if (refPath)
+	{
+		length = reference.max - base + 1;
+	}
+	else
+	{
+		while (length && image[length - 1] == 0xff)
+			--length;
+	}
+	
+	std::cout << syxPath << ": " << std::dec << blocks << " blocks, " << length << " bytes at 0x" << std::hex << base << std::endl;
+	
+	if (refPath)
+	{
+		if (image.size() < length)
+		{
+			std::cerr << "image is " << std::dec << length - image.size() << " bytes short of " << refPath << std::endl;
+			++errors;
+			image.resize(length, 0xff);
+		}
+		
+		size_t mismatches = 0;
+		for (size_t i = 0; i < length; ++i)
+		{
+			if (image[i] == reference[base + i])
+				continue;
+			
+			if (mismatches++ < MaxReported)
+			{
+				std::cerr << "mismatch at 0x" << std::hex << base + i << ": expected " << (int)reference[base + i] << ", got " << (int)image[i] << std::endl;
+			}
+		}
+		
+		if (mismatches)
+		{
+			std::cerr << std::dec << mismatches << " mismatched bytes" << std::endl;
+			++errors;
+		}
+	}
+	
+	char crc[16];
+	snprintf(crc, sizeof(crc), "%08x", crc32(&image[0], length));
+	std::cout << "crc32 " << crc << std::endl;
+	
+	if (outPath)
+	{
+		std::ofstream ofs(outPath, std::ios::out | std::ios::binary);
+		if (!ofs || !ofs.write(reinterpret_cast<const char*>(&image[0]), length))
+		{
+			std::cerr << "couldn't write " << outPath << std::endl;
+			return -1;
+		}
+	}
+	
+	if (errors)
+	{
+		std::cerr << "FAILED" << std::endl;
+		return 1;
+	}
+	
+	std::cout << (refPath ? "OK - matches " : "OK") << (refPath ? refPath : "") << std::endl;
+	return 0;
+}
@@ -0,0 +1,173 @@
+/******************************************************************************
+ 
+ Copyright (c) 2015, Focusrite Audio Engineering Ltd.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ * Neither the name of Focusrite Audio Engineering Ltd., nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ *****************************************************************************/
+
+// Decodes a trace dump captured from the device (the SysEx reply to
+// F0 7D 01 F7, saved as a .syx file) into a human readable timeline.
+//
+// usage: tracedump <dump.syx>
+
+#include <stdio.h>
+#include "app_defs.h"
+#include "sysex.h"
+#include "trace.h"
+
+static const char *PORT_NAMES[] = {"standalone", "usb", "din"};
+
+static const char *port_name(u8 port)
+{
+	return port < 3 ? PORT_NAMES[port] : "?";
+}
+
+static void print_event(u32 time, const struct TraceEvent *e)
+{
+	const u8 *d = e->data;
+
+	printf("%10lu.%03lu  ", (unsigned long)(time / 1000), (unsigned long)(time % 1000));
+
+	switch (TRACE_TYPE(e->event))
+	{
+		case TRACE_SURFACE:
+			printf("surface     type %d index %d value %d\n", d[0], d[1], d[2]);
+			break;
+		case TRACE_MIDI_IN:
+			printf("midi in     %-10s %02x %02x %02x\n", port_name(TRACE_PORT(e->event)), d[0], d[1], d[2]);
+			break;
+		case TRACE_MIDI_OUT:
+			printf("midi out    %-10s %02x %02x %02x\n", port_name(TRACE_PORT(e->event)), d[0], d[1], d[2]);
+			break;
+		case TRACE_SYSEX_IN:
+			printf("sysex in    %-10s %d bytes\n", port_name(TRACE_PORT(e->event)), d[0] | (d[1] << 7));
+			break;
+		case TRACE_STEP:
+			printf("step        %d at %d bpm\n", d[0], d[1]);
+			break;
+		case TRACE_PHRASE:
+			printf("phrase      instrument %d position %d phrase %d\n", d[0], d[1], d[2]);
+			break;
+		case TRACE_OVERRUN:
+			printf("OVERRUN     %lu cycles\n", (unsigned long)((d[0] << 16) | (d[1] << 8) | d[2]));
+			break;
+		case TRACE_COUNTERS:
+			printf("counters    thru dropped %d, pressure suppressed %d\n", d[0], (d[1] << 8) | d[2]);
+			break;
+		default:
+			printf("unknown     %02x %02x %02x %02x\n", e->event, d[0], d[1], d[2]);
+			break;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s <dump.syx>\n", argv[0]);
+		return -1;
+	}
+
+	FILE *f = fopen(argv[1], "rb");
+	if (!f)
+	{
+		perror(argv[1]);
+		return -1;
+	}
+
+	u8 message[320];
+	u16 length = 0;
+	int c;
+
+	// timestamps are 16 bit ms counters - unwrap them into a running time
+	u32 time = 0;
+	u16 last = 0;
+	int first = 1;
+	int events = 0;
+
+	while ((c = fgetc(f)) != EOF)
+	{
+		if (c == SYSEX_START)
+		{
+			length = 0;
+		}
+		if (length < sizeof(message))
+		{
+			message[length++] = c;
+		}
+		if (c != SYSEX_END || length < SYSEX_HEADER_SIZE + 4)
+		{
+			continue;
+		}
+		if (message[1] != SYSEX_MANUFACTURER || message[2] != SYSEX_TRACE_CHUNK)
+		{
+			continue;
+		}
+
+		struct TraceEvent chunk[TRACE_CHUNK];
+
+		// a chunk never packs to more than this, so anything longer is corrupt
+		// and would unpack past the end of chunk[]
+		if (length - 7 > SYSEX_PACKED_SIZE(sizeof(chunk)))
+		{
+			fprintf(stderr, "skipping a %d byte chunk, too long to be a trace\n", length);
+			continue;
+		}
+
+		u16 unpacked = SysexUnpack(&message[6], length - 7, (u8 *)chunk);
+		u8 count = message[5];
+
+		// only the events that actually arrived
+		if (count > unpacked / sizeof(struct TraceEvent))
+		{
+			count = unpacked / sizeof(struct TraceEvent);
+		}
+
+		for (u8 i = 0; i < count; i++)
+		{
+			if (first)
+			{
+				time = chunk[i].time;
+				first = 0;
+			}
+			else
+			{
+				time += (u16)(chunk[i].time - last);
+			}
+			last = chunk[i].time;
+
+			print_event(time, &chunk[i]);
+			events++;
+		}
+	}
+
+	fclose(f);
+
+	printf("%d events\n", events);
+	return 0;
+}